@@ -21,15 +21,33 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdalign.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#    include <linux/fiemap.h>
+#    include <linux/fs.h>
+#    include <sys/ioctl.h>
+#    include <sys/prctl.h>
+#endif
 
 #ifdef HAVE_CONFIG_H
 #    include "config.h"
@@ -38,18 +56,169 @@
 #define PROG_CANONICAL_NAME "srcstats"
 #define PROG_AUTHORS "Ar Rakin <rakinar2@onesoftnet.eu.org>"
 
-/* TODO: Add support for more file types, and
-   output statistics separately for each file type. */
+#define CACHE_LINE_SIZE 64
+
+/* Duplicate detection fingerprints windows of this many code lines, and
+   spreads the fingerprints over this many index shards.  Fingerprints
+   found more often than DUP_MAX_COPIES times are dropped, as they come
+   from boilerplate such as table rows rather than from copied code.  Only
+   the largest clone groups are shown, and only the first few copies in
+   each.  */
+#define DUP_KGRAM_LINES 5
+#define DUP_SHARDS 64
+#define DUP_MAX_COPIES 1000
+#define DUP_GROUPS_SHOWN 10
+#define DUP_LOCATIONS_SHOWN 10
+
+/* With --cold-cache, how many files to read ahead of the one being
+   analyzed.  */
+#define IO_READAHEAD_FILES 16
+
+/* With --processes, how many files can be queued for each process.  */
+#define PROCESS_QUEUE_FILES 64
+
+/* How often --progress updates the status line, and how long without
+   any file being finished before a scan is shown as stalled.  */
+#define PROGRESS_INTERVAL_MS 500
+#define PROGRESS_STALL_SECONDS 5
+
+enum
+{
+    OPT_IO_WINDOW = 256,
+    OPT_COLD_CACHE,
+    OPT_SHARD,
+    OPT_EMIT_REPORT,
+    OPT_REPORT_FILES,
+    OPT_MERGE,
+    OPT_PROGRESS,
+    OPT_PROCESSES,
+    OPT_FILE_TIMEOUT,
+    OPT_MAX_FILE_SIZE
+};
+
+/* TODO: Add support for more file types. */
 
 static const char *prog_name = NULL;
 
 static struct option const long_options[] = {
-    { "help",    no_argument, 0, 'h' },
-    { "version", no_argument, 0, 'v' },
-    { 0,         0,           0, 0   }
+    { "help",          no_argument,       0, 'h'               },
+    { "version",       no_argument,       0, 'v'               },
+    { "jobs",          required_argument, 0, 'j'               },
+    { "top",           required_argument, 0, 't'               },
+    { "depth",         required_argument, 0, 'd'               },
+    { "languages",     no_argument,       0, 'l'               },
+    { "extensions",    no_argument,       0, 'e'               },
+    { "duplicates",    optional_argument, 0, 'D'               },
+    { "io-window",     required_argument, 0, OPT_IO_WINDOW     },
+    { "cold-cache",    no_argument,       0, OPT_COLD_CACHE    },
+    { "shard",         required_argument, 0, OPT_SHARD         },
+    { "emit-report",   required_argument, 0, OPT_EMIT_REPORT   },
+    { "report-files",  no_argument,       0, OPT_REPORT_FILES  },
+    { "merge",         no_argument,       0, OPT_MERGE         },
+    { "progress",      no_argument,       0, OPT_PROGRESS      },
+    { "processes",     required_argument, 0, OPT_PROCESSES     },
+    { "file-timeout",  required_argument, 0, OPT_FILE_TIMEOUT  },
+    { "max-file-size", required_argument, 0, OPT_MAX_FILE_SIZE },
+    { 0,               0,                 0, 0                 }
+};
+
+static const char *short_options = "hvj:t:d:leD::";
+
+/* Number of threads analyzing files.  With a single job, files are
+   analyzed by the thread walking the directory tree. */
+static size_t opt_jobs = 1;
+
+/* Per-directory rollup: how many of the heaviest directories to list
+   (0 means all of them), and how deep below the root to look. */
+static bool opt_dirs = false;
+static size_t opt_top = 0;
+static size_t opt_depth = SIZE_MAX;
+
+/* Whether to print the per-language and per-file-type breakdowns.  */
+static bool opt_languages = false;
+static bool opt_extensions = false;
+
+/* Duplicate code detection, and the shortest clone (in lines of code)
+   worth reporting.  */
+static bool opt_duplicates = false;
+static size_t opt_duplicate_lines = 8;
+
+/* Files are read in batches of this many, ordered by inode number (or
+   by physical location, with --cold-cache) to avoid seeking.  With
+   --cold-cache, upcoming files are also read ahead, and files are
+   dropped from the page cache once they have been analyzed.  */
+static size_t opt_io_window = 256;
+static bool opt_cold_cache = false;
+
+/* Only scan the files whose path hashes to shard OPT_SHARD (counting
+   from 1) of OPT_SHARD_COUNT, and write the results to a binary report
+   which can later be merged with those of the other shards.  */
+static size_t opt_shard = 1;
+static size_t opt_shard_count = 1;
+static const char *opt_emit_report = NULL;
+static bool opt_report_files = false;
+static bool opt_merge = false;
+
+/* Whether to show the progress of scans on stderr.  */
+static bool opt_progress = false;
+
+/* Number of processes analyzing files (0 to use threads instead), and
+   the limits past which a file is given up on: how long one file may
+   take in a process, in seconds, and how large it may be (0 for no
+   limit).  */
+static size_t opt_processes = 0;
+static size_t opt_file_timeout = 60;
+static bool opt_file_timeout_set = false;
+static size_t opt_max_file_size = 0;
+
+enum codebase_language
+{
+    LANG_C,
+    LANG_CPP,
+    LANG_JAVA,
+    LANG_JAVASCRIPT,
+    LANG_TYPESCRIPT,
+    LANG_SHELL,
+    LANG_BASH,
+    LANG_ZSH,
+    LANG_FISH,
+    LANG_CSH,
+    LANG_MAKEFILE,
+    LANG_AUTOMAKE,
+    LANG_AUTOCONF,
+    LANG_DOCKERFILE,
+    LANG_CONFIG,
+    LANG_COUNT
+};
+
+static const char *const codebase_language_names[LANG_COUNT] = {
+    [LANG_C] = "C",
+    [LANG_CPP] = "C++",
+    [LANG_JAVA] = "Java",
+    [LANG_JAVASCRIPT] = "JavaScript",
+    [LANG_TYPESCRIPT] = "TypeScript",
+    [LANG_SHELL] = "Shell",
+    [LANG_BASH] = "Bash",
+    [LANG_ZSH] = "Zsh",
+    [LANG_FISH] = "Fish",
+    [LANG_CSH] = "C Shell",
+    [LANG_MAKEFILE] = "Makefile",
+    [LANG_AUTOMAKE] = "Automake",
+    [LANG_AUTOCONF] = "Autoconf",
+    [LANG_DOCKERFILE] = "Dockerfile",
+    [LANG_CONFIG] = "Config",
 };
 
-static const char *short_options = "hv";
+/* Hashes of the normalized code lines of the file being analyzed, and
+   where they are in the file.  Only collected for duplicate detection. */
+struct codebase_code_lines
+{
+    uint64_t *hashes;
+    uint32_t *numbers;
+    size_t count;
+    size_t capacity;
+    unsigned long int first_line;
+};
 
 struct codebase_scan_state
 {
@@ -58,18 +227,246 @@ struct codebase_scan_state
     char *extension;
     char *shebang_prog;
     struct codebase_report *report;
+    struct codebase_code_lines *code;
+};
+
+/* Directory names are interned: every distinct name is stored once in
+   the pool, and directory nodes refer to it by offset. */
+struct codebase_strpool
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+    uint32_t *slots; /* Offset + 1 of each interned name, 0 if empty. */
+    size_t slot_count;
+    size_t count;
+};
+
+/* A node of the directory trie.  Nodes only point to their parent, and
+   a parent is always created before its children, so subtree totals
+   can be rolled up in a single reverse pass over the node array. */
+struct codebase_dirnode
+{
+    uint32_t name;
+    uint32_t parent;
+    uint32_t depth;
+    uint32_t files;
+    uint32_t directories;
+    uint64_t lines;
+    uint64_t blank_lines;
+    uint64_t comment_lines;
+    uint64_t code_lines;
+};
+
+struct codebase_dirtree
+{
+    struct codebase_dirnode *nodes;
+    size_t count;
+    size_t capacity;
+    struct codebase_strpool names;
+};
+
+/* Per-directory totals collected by a single worker.  Only directories
+   the worker has seen files in get an entry; entries are merged into the
+   trie once the scan has finished. */
+struct codebase_dirstats
+{
+    uint32_t key; /* Node index + 1, 0 if the slot is empty. */
+    uint32_t files;
+    uint64_t lines;
+    uint64_t blank_lines;
+    uint64_t comment_lines;
+    uint64_t code_lines;
+};
+
+struct codebase_dirmap
+{
+    struct codebase_dirstats *entries;
+    size_t capacity;
+    size_t count;
+};
+
+struct codebase_counts
+{
+    uint64_t files;
+    uint64_t lines;
+    uint64_t blank_lines;
+    uint64_t comment_lines;
+    uint64_t code_lines;
+};
+
+/* A file kept for duplicate detection.  */
+struct codebase_dup_file
+{
+    char *path;
+    enum codebase_language language;
+    uint32_t id;
+    uint64_t *hashes;
+    uint32_t *numbers;
+    uint32_t count;
+    unsigned char *duplicated;
 };
 
+struct codebase_fingerprint
+{
+    uint64_t hash;
+    uint32_t file;
+    uint32_t pos;
+};
+
+struct codebase_fingerprints
+{
+    struct codebase_fingerprint *items;
+    size_t count;
+    size_t capacity;
+};
+
+/* A worker's share of the duplicate detection state.  The files a
+   worker keeps get the global IDs WORKER, WORKER + N, WORKER + 2N, ...
+   where N is the number of workers.  */
+struct codebase_dup_worker
+{
+    struct codebase_code_lines code;
+    struct codebase_dup_file *files;
+    size_t file_count;
+    size_t file_capacity;
+    struct codebase_fingerprints shards[DUP_SHARDS];
+};
+
+struct codebase_dup_location
+{
+    char *path;
+    uint32_t first_line;
+    uint32_t last_line;
+};
+
+struct codebase_dup_group
+{
+    uint32_t lines;
+    size_t count;
+    struct codebase_dup_location *locations;
+    size_t location_count;
+};
+
+struct codebase_duplicates
+{
+    uint64_t lines[LANG_COUNT];
+    struct codebase_dup_group groups[DUP_GROUPS_SHOWN];
+    size_t group_count;
+};
+
+struct codebase_file_record
+{
+    char *path;
+    enum codebase_language language;
+    struct codebase_counts counts;
+};
+
+/* The shards of one sharded scan that a report covers.  Scans are told
+   apart by a hash of the directories they were given.  */
+struct codebase_shard_set
+{
+    uint64_t scan;
+    uint32_t count;
+    uint64_t *shards; /* One bit per shard.  */
+};
+
+struct codebase_scanner;
+
 struct codebase_report
 {
     unsigned long int files;
     unsigned long int ignored;
+    unsigned long int failed;
     unsigned long int directories;
     unsigned long int lines;
     unsigned long int blank_lines;
     unsigned long int comment_lines;
     unsigned long int code_lines;
     char *directory;
+    struct codebase_counts languages[LANG_COUNT];
+    struct codebase_counts *types;
+    struct codebase_duplicates duplicates;
+    struct codebase_file_record *records;
+    size_t record_count;
+    size_t record_capacity;
+    struct codebase_shard_set *shard_sets;
+    size_t shard_set_count;
+    struct codebase_dirtree dirtree;
+    struct codebase_scanner *scanner;
+};
+
+struct codebase_scan_item
+{
+    char *path;
+    uint32_t node;
+    off_t size;
+    ino_t ino;
+    uint64_t physical; /* UINT64_MAX if unknown.  */
+};
+
+struct codebase_scan_queue
+{
+    struct codebase_scan_item *items;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    bool closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+/* A worker's report is its private shard of the counters.  Workers are
+   aligned to cache lines (and so is each shard's per-type array), so
+   that no two threads ever write to the same line.  */
+struct codebase_worker
+{
+    alignas (CACHE_LINE_SIZE) struct codebase_report report;
+    struct codebase_dirmap dirs;
+    struct codebase_dup_worker dups;
+    struct codebase_scanner *scanner;
+    pthread_t thread;
+
+    /* Progress, only written by the worker itself.  The current path is
+       handed over to whoever exchanges it out.  */
+    alignas (CACHE_LINE_SIZE) _Atomic uint64_t done_files;
+    _Atomic uint64_t done_bytes;
+    _Atomic (char *) current_path;
+};
+
+struct codebase_progress
+{
+    struct codebase_scanner *scanner;
+    bool tty;
+    bool stopping;
+    double start;
+    double last_change;
+    uint64_t last_files;
+    uint64_t last_bytes;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+};
+
+struct codebase_process_pool;
+
+struct codebase_scanner
+{
+    struct codebase_worker *workers;
+    size_t worker_count;
+    bool threaded;
+    struct codebase_scan_queue queue;
+    struct codebase_scan_item *window;
+    size_t window_count;
+    struct codebase_process_pool *processes;
+    unsigned long int skipped;
+    struct codebase_dup_file **dup_files; /* By rank.  */
+    uint32_t *dup_ranks;                  /* By file ID.  */
+    struct codebase_progress *progress;
+    _Atomic uint64_t found_files;
+    _Atomic uint64_t found_bytes;
+    atomic_bool walk_done;
 };
 
 static void codebase_report_analyze_c (struct codebase_scan_state *state,
@@ -77,75 +474,99 @@ static void codebase_report_analyze_c (struct codebase_scan_state *state,
 static void codebase_report_analyze_sh (struct codebase_scan_state *state,
                                         FILE *file);
 
+enum codebase_match
+{
+    MATCH_EXTENSION,
+    MATCH_FILENAME,
+    MATCH_SHEBANG
+};
+
+/* A file extension, name or shebang program recognized by a handler.
+   The ID and match kind are assigned by codebase_file_types_init(), and
+   index the per-type counters.  */
+struct codebase_file_type
+{
+    const char *name;
+    enum codebase_language language;
+    enum codebase_match match;
+    size_t id;
+};
+
 struct codebase_file_handler
 {
     void (*handler) (struct codebase_scan_state *, FILE *);
-    const char **extensions;
-    const char **filenames;
-    const char **shebangs;
+    struct codebase_file_type *extensions;
+    struct codebase_file_type *filenames;
+    struct codebase_file_type *shebangs;
 };
 
 /* clang-format off */
 static struct codebase_file_handler codebase_file_handlers[] = {
     { 
         .handler = &codebase_report_analyze_c,  
-        .extensions = (const char *[]) { 
-            "c", 
-            "h", 
-            "cpp", 
-            "hpp", 
-            "cc", 
-            "hh", 
-            "cxx",
-            "hxx", 
-            "ts", 
-            "js",
-            "java",
-            NULL 
+        .extensions = (struct codebase_file_type[]) { 
+            { .name = "c",    .language = LANG_C          }, 
+            { .name = "h",    .language = LANG_C          }, 
+            { .name = "cpp",  .language = LANG_CPP        }, 
+            { .name = "hpp",  .language = LANG_CPP        }, 
+            { .name = "cc",   .language = LANG_CPP        }, 
+            { .name = "hh",   .language = LANG_CPP        }, 
+            { .name = "cxx",  .language = LANG_CPP        },
+            { .name = "hxx",  .language = LANG_CPP        }, 
+            { .name = "ts",   .language = LANG_TYPESCRIPT }, 
+            { .name = "js",   .language = LANG_JAVASCRIPT },
+            { .name = "java", .language = LANG_JAVA       },
+            { NULL }
         },
         .filenames = NULL,
         .shebangs = NULL
     },
     { 
         .handler = &codebase_report_analyze_sh,
-        .extensions = (const char *[]) { 
-            "sh", 
-            "bash", 
-            "conf", 
-            "fish", 
-            "csh", 
-            "zsh",
-            "am",
-            "ac",
-            NULL
+        .extensions = (struct codebase_file_type[]) { 
+            { .name = "sh",   .language = LANG_SHELL    }, 
+            { .name = "bash", .language = LANG_BASH     }, 
+            { .name = "conf", .language = LANG_CONFIG   }, 
+            { .name = "fish", .language = LANG_FISH     }, 
+            { .name = "csh",  .language = LANG_CSH      }, 
+            { .name = "zsh",  .language = LANG_ZSH      },
+            { .name = "am",   .language = LANG_AUTOMAKE },
+            { .name = "ac",   .language = LANG_AUTOCONF },
+            { NULL }
         },
-        .filenames = (const char *[]) { 
-            "Makefile",
-            "Dockerfile",
-            NULL
+        .filenames = (struct codebase_file_type[]) { 
+            { .name = "Makefile",   .language = LANG_MAKEFILE   },
+            { .name = "Dockerfile", .language = LANG_DOCKERFILE },
+            { NULL }
         },
-       .shebangs = (const char *[]) { 
-            "sh", 
-            "bash", 
-            "fish", 
-            "zsh",
-            "csh",
-            NULL
+       .shebangs = (struct codebase_file_type[]) { 
+            { .name = "sh",   .language = LANG_SHELL }, 
+            { .name = "bash", .language = LANG_BASH  }, 
+            { .name = "fish", .language = LANG_FISH  }, 
+            { .name = "zsh",  .language = LANG_ZSH   },
+            { .name = "csh",  .language = LANG_CSH   },
+            { NULL }
         } 
     },
 };
 /* clang-format on */
 
+static struct codebase_file_type **codebase_file_types = NULL;
+static size_t codebase_file_type_count = 0;
+
 static void
 report_error (const char *format, ...)
 {
     va_list args;
+    int errnum = errno;
     va_start (args, format);
+    flockfile (stderr);
     fprintf (stderr, "%s: ", prog_name);
     vfprintf (stderr, format, args);
-    fprintf (stderr, ": %s", strerror (errno));
-    va_end (args);
+    fprintf (stderr, ": %s", strerror (errnum));
     fputc ('\n', stderr);
+    funlockfile (stderr);
+    va_end (args);
 }
 
 static void *
@@ -162,6 +583,60 @@ xrealloc (void *ptr, size_t size)
     return new_ptr;
 }
 
+static void *
+xcalloc (size_t count, size_t size)
+{
+    void *ptr = calloc (count, size);
+
+    if (ptr == NULL)
+        {
+            report_error ("xcalloc(): failed to allocate memory");
+            exit (EXIT_FAILURE);
+        }
+
+    return ptr;
+}
+
+/* Allocate zeroed memory which starts on a cache line and is padded to
+   a whole number of cache lines.  */
+static void *
+xaligned_alloc (size_t size)
+{
+    size_t padded = size + CACHE_LINE_SIZE - 1;
+    void *ptr;
+
+    padded -= padded % CACHE_LINE_SIZE;
+
+    if (padded == 0)
+        padded = CACHE_LINE_SIZE;
+
+    ptr = aligned_alloc (CACHE_LINE_SIZE, padded);
+
+    if (ptr == NULL)
+        {
+            report_error ("xaligned_alloc(): failed to allocate memory");
+            exit (EXIT_FAILURE);
+        }
+
+    memset (ptr, 0, padded);
+    return ptr;
+}
+
+static uint64_t
+hash_bytes (const void *data, size_t len)
+{
+    const unsigned char *bytes = data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < len; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ULL;
+        }
+
+    return hash;
+}
+
 static char *
 path_join (const char *p1, const char *p2, size_t *len)
 {
@@ -199,6 +674,252 @@ path_join (const char *p1, const char *p2, size_t *len)
     return path;
 }
 
+static void
+codebase_strpool_rehash (struct codebase_strpool *pool, size_t slot_count)
+{
+    uint32_t *slots = xcalloc (slot_count, sizeof (uint32_t));
+
+    for (size_t i = 0; i < pool->slot_count; i++)
+        {
+            if (pool->slots[i] == 0)
+                continue;
+
+            const char *name = pool->data + pool->slots[i] - 1;
+            size_t slot = hash_bytes (name, strlen (name)) & (slot_count - 1);
+
+            while (slots[slot] != 0)
+                slot = (slot + 1) & (slot_count - 1);
+
+            slots[slot] = pool->slots[i];
+        }
+
+    free (pool->slots);
+    pool->slots = slots;
+    pool->slot_count = slot_count;
+}
+
+static uint32_t
+codebase_strpool_intern (struct codebase_strpool *pool, const char *name)
+{
+    size_t len = strlen (name);
+
+    if ((pool->count + 1) * 2 > pool->slot_count)
+        codebase_strpool_rehash (pool, pool->slot_count == 0
+                                           ? 64
+                                           : pool->slot_count * 2);
+
+    size_t slot = hash_bytes (name, len) & (pool->slot_count - 1);
+
+    while (pool->slots[slot] != 0)
+        {
+            if (strcmp (pool->data + pool->slots[slot] - 1, name) == 0)
+                return pool->slots[slot] - 1;
+
+            slot = (slot + 1) & (pool->slot_count - 1);
+        }
+
+    if (pool->size + len + 1 >= UINT32_MAX)
+        {
+            errno = ENOMEM;
+            report_error ("too many distinct directory names");
+            exit (EXIT_FAILURE);
+        }
+
+    if (pool->size + len + 1 > pool->capacity)
+        {
+            while (pool->size + len + 1 > pool->capacity)
+                pool->capacity = pool->capacity == 0 ? 4096
+                                                     : pool->capacity * 2;
+
+            pool->data = xrealloc (pool->data, pool->capacity);
+        }
+
+    uint32_t offset = pool->size;
+
+    memcpy (pool->data + offset, name, len + 1);
+    pool->size += len + 1;
+    pool->slots[slot] = offset + 1;
+    pool->count++;
+    return offset;
+}
+
+static void
+codebase_strpool_free (struct codebase_strpool *pool)
+{
+    free (pool->data);
+    free (pool->slots);
+}
+
+static uint32_t
+codebase_dirtree_add (struct codebase_dirtree *tree, const char *name,
+                      uint32_t parent)
+{
+    if (tree->count >= UINT32_MAX - 1)
+        {
+            errno = ENOMEM;
+            report_error ("too many directories");
+            exit (EXIT_FAILURE);
+        }
+
+    if (tree->count == tree->capacity)
+        {
+            tree->capacity = tree->capacity == 0 ? 256 : tree->capacity * 2;
+            tree->nodes = xrealloc (tree->nodes, tree->capacity
+                                                     * sizeof (*tree->nodes));
+        }
+
+    struct codebase_dirnode *node = &tree->nodes[tree->count];
+
+    *node = (struct codebase_dirnode) {
+        .name = codebase_strpool_intern (&tree->names, name),
+        .parent = parent,
+        .depth = tree->count == 0 ? 0 : tree->nodes[parent].depth + 1,
+    };
+
+    return tree->count++;
+}
+
+/* Fold every node's totals into its ancestors.  */
+static void
+codebase_dirtree_rollup (struct codebase_dirtree *tree)
+{
+    for (size_t i = tree->count; i-- > 1;)
+        {
+            const struct codebase_dirnode *node = &tree->nodes[i];
+            struct codebase_dirnode *parent = &tree->nodes[node->parent];
+
+            parent->files += node->files;
+            parent->directories += node->directories + 1;
+            parent->lines += node->lines;
+            parent->blank_lines += node->blank_lines;
+            parent->comment_lines += node->comment_lines;
+            parent->code_lines += node->code_lines;
+        }
+}
+
+static char *
+codebase_dirtree_path (const struct codebase_dirtree *tree, uint32_t index)
+{
+    size_t length = 0;
+    char *path;
+
+    for (uint32_t i = index;; i = tree->nodes[i].parent)
+        {
+            length += strlen (tree->names.data + tree->nodes[i].name) + 1;
+
+            if (i == 0)
+                break;
+        }
+
+    path = xrealloc (NULL, length);
+    path[--length] = 0;
+
+    for (uint32_t i = index;; i = tree->nodes[i].parent)
+        {
+            const char *name = tree->names.data + tree->nodes[i].name;
+            size_t name_len = strlen (name);
+
+            length -= name_len;
+            memcpy (path + length, name, name_len);
+
+            if (i == 0)
+                break;
+
+            path[--length] = '/';
+        }
+
+    return path;
+}
+
+static void
+codebase_dirtree_free (struct codebase_dirtree *tree)
+{
+    free (tree->nodes);
+    codebase_strpool_free (&tree->names);
+}
+
+static struct codebase_dirstats *
+codebase_dirmap_get (struct codebase_dirmap *map, uint32_t node)
+{
+    if ((map->count + 1) * 2 > map->capacity)
+        {
+            size_t capacity = map->capacity == 0 ? 64 : map->capacity * 2;
+            struct codebase_dirstats *entries
+                = xcalloc (capacity, sizeof (*entries));
+
+            for (size_t i = 0; i < map->capacity; i++)
+                {
+                    if (map->entries[i].key == 0)
+                        continue;
+
+                    size_t slot = (map->entries[i].key * 0x9e3779b1U)
+                                  & (capacity - 1);
+
+                    while (entries[slot].key != 0)
+                        slot = (slot + 1) & (capacity - 1);
+
+                    entries[slot] = map->entries[i];
+                }
+
+            free (map->entries);
+            map->entries = entries;
+            map->capacity = capacity;
+        }
+
+    uint32_t key = node + 1;
+    size_t slot = (key * 0x9e3779b1U) & (map->capacity - 1);
+
+    while (map->entries[slot].key != 0 && map->entries[slot].key != key)
+        slot = (slot + 1) & (map->capacity - 1);
+
+    if (map->entries[slot].key == 0)
+        {
+            map->entries[slot].key = key;
+            map->count++;
+        }
+
+    return &map->entries[slot];
+}
+
+/* Count LINE as a line of code, and remember it when looking for
+   duplicates.  Whitespace is ignored, so that reindented copies of a
+   line hash alike.  */
+static void
+codebase_scan_state_code_line (struct codebase_scan_state *state,
+                               const char *line, ssize_t len)
+{
+    struct codebase_code_lines *code = state->code;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    state->report->code_lines++;
+
+    if (code == NULL)
+        return;
+
+    for (ssize_t i = 0; i < len; i++)
+        {
+            if (isspace ((unsigned char) line[i]))
+                continue;
+
+            hash ^= (unsigned char) line[i];
+            hash *= 0x100000001b3ULL;
+        }
+
+    if (code->count == code->capacity)
+        {
+            code->capacity = code->capacity == 0 ? 256 : code->capacity * 2;
+            code->hashes = xrealloc (code->hashes,
+                                     code->capacity * sizeof (*code->hashes));
+            code->numbers = xrealloc (
+                code->numbers, code->capacity * sizeof (*code->numbers));
+        }
+
+    code->hashes[code->count] = hash;
+    code->numbers[code->count]
+        = state->report->lines - code->first_line;
+    code->count++;
+}
+
 static void
 codebase_report_analyze_c (struct codebase_scan_state *state, FILE *file)
 {
@@ -278,7 +999,8 @@ codebase_report_analyze_c (struct codebase_scan_state *state, FILE *file)
                                     if (line[0] == quote)
                                         break;
 
-                                    report->code_lines++;
+                                    codebase_scan_state_code_line (state, line,
+                                                                   read);
                                 }
 
                             continue;
@@ -286,7 +1008,7 @@ codebase_report_analyze_c (struct codebase_scan_state *state, FILE *file)
 
                     if (i == read)
                         {
-                            report->code_lines++;
+                            codebase_scan_state_code_line (state, line, read);
                             continue;
                         }
                 }
@@ -327,7 +1049,7 @@ codebase_report_analyze_c (struct codebase_scan_state *state, FILE *file)
                 i++;
 
             if (!in_comment && i < read)
-                report->code_lines++;
+                codebase_scan_state_code_line (state, line, read);
         }
 
     free (line);
@@ -389,7 +1111,7 @@ codebase_report_analyze_sh (struct codebase_scan_state *state, FILE *file)
                             if (strcmp (line, token) == 0)
                                 break;
 
-                            report->code_lines++;
+                            codebase_scan_state_code_line (state, line, read);
                         }
 
                     free (token);
@@ -424,7 +1146,8 @@ codebase_report_analyze_sh (struct codebase_scan_state *state, FILE *file)
                                     if (line[0] == quote)
                                         break;
 
-                                    report->code_lines++;
+                                    codebase_scan_state_code_line (state, line,
+                                                                   read);
                                 }
 
                             continue;
@@ -432,7 +1155,7 @@ codebase_report_analyze_sh (struct codebase_scan_state *state, FILE *file)
 
                     if (i == read)
                         {
-                            report->code_lines++;
+                            codebase_scan_state_code_line (state, line, read);
                             continue;
                         }
                 }
@@ -441,12 +1164,47 @@ codebase_report_analyze_sh (struct codebase_scan_state *state, FILE *file)
                 i++;
 
             if (i < read)
-                report->code_lines++;
+                codebase_scan_state_code_line (state, line, read);
         }
 
     free (line);
 }
 
+static void
+codebase_file_types_register (struct codebase_file_type *types,
+                              enum codebase_match match)
+{
+    if (types == NULL)
+        return;
+
+    for (size_t i = 0; types[i].name != NULL; i++)
+        {
+            types[i].match = match;
+            types[i].id = codebase_file_type_count++;
+            codebase_file_types = xrealloc (
+                codebase_file_types,
+                codebase_file_type_count * sizeof (*codebase_file_types));
+            codebase_file_types[types[i].id] = &types[i];
+        }
+}
+
+/* Give every recognized file type a dense ID.  */
+static void
+codebase_file_types_init (void)
+{
+    for (size_t i = 0; i < sizeof (codebase_file_handlers)
+                               / sizeof (codebase_file_handlers[0]);
+         i++)
+        {
+            codebase_file_types_register (codebase_file_handlers[i].extensions,
+                                          MATCH_EXTENSION);
+            codebase_file_types_register (codebase_file_handlers[i].filenames,
+                                          MATCH_FILENAME);
+            codebase_file_types_register (codebase_file_handlers[i].shebangs,
+                                          MATCH_SHEBANG);
+        }
+}
+
 static void
 codebase_scan_state_free (struct codebase_scan_state *state)
 {
@@ -485,9 +1243,11 @@ get_file_shebang (FILE *file)
     return ret;
 }
 
-static void
+/* Analyze FILE with the first handler that recognizes it.  Returns the
+   file type that matched, or NULL if the file was ignored.  */
+static const struct codebase_file_type *
 codebase_report_analyze_file (struct codebase_report *report, const char *path,
-                              FILE *file)
+                              FILE *file, struct codebase_code_lines *code)
 {
     const char *extension = strrchr (path, '.');
     const char *filename = strrchr (path, '/');
@@ -505,17 +1265,20 @@ codebase_report_analyze_file (struct codebase_report *report, const char *path,
                 .extension = NULL,
                 .shebang_prog = NULL,
                 .report = report,
+                .code = code,
             };
 
             if (codebase_file_handlers[i].extensions != NULL)
                 {
                     for (size_t j = 0;
-                         codebase_file_handlers[i].extensions[j] != NULL; j++)
+                         codebase_file_handlers[i].extensions[j].name != NULL;
+                         j++)
                         {
                             if (extension != NULL
-                                && strcmp (
-                                       extension,
-                                       codebase_file_handlers[i].extensions[j])
+                                && strcmp (extension,
+                                           codebase_file_handlers[i]
+                                               .extensions[j]
+                                               .name)
                                        == 0)
                                 {
                                     state.extension = strdup (extension);
@@ -523,7 +1286,8 @@ codebase_report_analyze_file (struct codebase_report *report, const char *path,
                                                                        file);
                                     codebase_scan_state_free (&state);
                                     report->files++;
-                                    return;
+                                    return &codebase_file_handlers[i]
+                                                .extensions[j];
                                 }
                         }
                 }
@@ -531,17 +1295,20 @@ codebase_report_analyze_file (struct codebase_report *report, const char *path,
             if (codebase_file_handlers[i].filenames != NULL)
                 {
                     for (size_t j = 0;
-                         codebase_file_handlers[i].filenames[j] != NULL; j++)
+                         codebase_file_handlers[i].filenames[j].name != NULL;
+                         j++)
                         {
-                            if (strcmp (filename,
-                                        codebase_file_handlers[i].filenames[j])
+                            if (strcmp (filename, codebase_file_handlers[i]
+                                                      .filenames[j]
+                                                      .name)
                                 == 0)
                                 {
                                     codebase_file_handlers[i].handler (&state,
                                                                        file);
                                     codebase_scan_state_free (&state);
                                     report->files++;
-                                    return;
+                                    return &codebase_file_handlers[i]
+                                                .filenames[j];
                                 }
                         }
                 }
@@ -556,10 +1323,11 @@ codebase_report_analyze_file (struct codebase_report *report, const char *path,
                     continue;
                 }
 
-            for (size_t j = 0; codebase_file_handlers[i].shebangs[j] != NULL;
-                 j++)
+            for (size_t j = 0;
+                 codebase_file_handlers[i].shebangs[j].name != NULL; j++)
                 {
-                    const char *prog = codebase_file_handlers[i].shebangs[j];
+                    const char *prog
+                        = codebase_file_handlers[i].shebangs[j].name;
                     const char *shebang_ptr = shebang;
 
                     if (strncmp (shebang_ptr, "/usr/bin/", 9) == 0)
@@ -581,7 +1349,7 @@ codebase_report_analyze_file (struct codebase_report *report, const char *path,
                             codebase_scan_state_free (&state);
                             free (shebang);
                             report->files++;
-                            return;
+                            return &codebase_file_handlers[i].shebangs[j];
                         }
                 }
 
@@ -591,39 +1359,2745 @@ codebase_report_analyze_file (struct codebase_report *report, const char *path,
         }
 
     report->ignored++;
+    return NULL;
 }
 
 static void
 codebase_report_free (struct codebase_report *report)
 {
     free ((void *) report->directory);
-}
+    free (report->types);
+    codebase_dirtree_free (&report->dirtree);
 
-static bool
-codebase_report_scan (struct codebase_report *report, const char *directory)
-{
-    DIR *dirstream = opendir (directory);
-    struct dirent *entry;
-    char **entries = NULL;
-    size_t entries_size = 0;
+    for (size_t i = 0; i < report->record_count; i++)
+        free (report->records[i].path);
 
-    if (dirstream == NULL)
-        {
-            report_error ("failed to open directory `%s'", directory);
-            return false;
-        }
+    free (report->records);
 
-    report->directories++;
+    for (size_t i = 0; i < report->shard_set_count; i++)
+        free (report->shard_sets[i].shards);
 
-    while ((entry = readdir (dirstream)) != NULL)
+    free (report->shard_sets);
+
+    for (size_t i = 0; i < report->duplicates.group_count; i++)
         {
-            if (strcmp (entry->d_name, ".") == 0
-                || strcmp (entry->d_name, "..") == 0)
-                continue;
+            struct codebase_dup_group *group = &report->duplicates.groups[i];
 
-            entries = xrealloc (entries, (++entries_size) * sizeof (char *));
-            entries[entries_size - 1] = strdup (entry->d_name);
-        }
+            for (size_t j = 0; j < group->location_count; j++)
+                free (group->locations[j].path);
+
+            free (group->locations);
+        }
+}
+
+static void
+codebase_counts_add (struct codebase_counts *counts,
+                     const struct codebase_counts *other)
+{
+    counts->files += other->files;
+    counts->lines += other->lines;
+    counts->blank_lines += other->blank_lines;
+    counts->comment_lines += other->comment_lines;
+    counts->code_lines += other->code_lines;
+}
+
+/* Add the file and line counters of OTHER, including the per-language
+   and per-type breakdowns, to REPORT.  */
+static void
+codebase_report_merge (struct codebase_report *report,
+                       const struct codebase_report *other)
+{
+    report->files += other->files;
+    report->ignored += other->ignored;
+    report->failed += other->failed;
+    report->directories += other->directories;
+    report->lines += other->lines;
+    report->blank_lines += other->blank_lines;
+    report->comment_lines += other->comment_lines;
+    report->code_lines += other->code_lines;
+
+    for (size_t i = 0; i < LANG_COUNT; i++)
+        codebase_counts_add (&report->languages[i], &other->languages[i]);
+
+    for (size_t i = 0; i < codebase_file_type_count; i++)
+        codebase_counts_add (&report->types[i], &other->types[i]);
+}
+
+/* Lines per fingerprinted run of code lines.  */
+static size_t
+codebase_dup_kgram_lines (void)
+{
+    return opt_duplicate_lines < DUP_KGRAM_LINES ? opt_duplicate_lines
+                                                 : DUP_KGRAM_LINES;
+}
+
+static struct codebase_dup_file *
+codebase_dup_file_get (struct codebase_scanner *scanner, uint32_t rank)
+{
+    return scanner->dup_files[rank];
+}
+
+static int
+codebase_dup_file_compare (const void *a, const void *b)
+{
+    const struct codebase_dup_file *const *file_a = a;
+    const struct codebase_dup_file *const *file_b = b;
+
+    return strcmp ((*file_a)->path, (*file_b)->path);
+}
+
+/* File IDs depend on which worker analyzed each file, so the index
+   refers to files by their rank in path order instead, which keeps the
+   results the same from one run to the next.  */
+static void
+codebase_dup_rank_files (struct codebase_scanner *scanner)
+{
+    size_t count = 0, id_count = 0;
+
+    for (size_t i = 0; i < scanner->worker_count; i++)
+        {
+            const size_t file_count = scanner->workers[i].dups.file_count;
+
+            count += file_count;
+
+            if (file_count * scanner->worker_count > id_count)
+                id_count = file_count * scanner->worker_count;
+        }
+
+    scanner->dup_files = xcalloc (count + 1, sizeof (*scanner->dup_files));
+    scanner->dup_ranks = xcalloc (id_count + 1, sizeof (uint32_t));
+    count = 0;
+
+    for (size_t i = 0; i < scanner->worker_count; i++)
+        for (size_t j = 0; j < scanner->workers[i].dups.file_count; j++)
+            scanner->dup_files[count++] = &scanner->workers[i].dups.files[j];
+
+    if (count != 0)
+        qsort (scanner->dup_files, count, sizeof (*scanner->dup_files),
+               &codebase_dup_file_compare);
+
+    for (size_t i = 0; i < count; i++)
+        scanner->dup_ranks[scanner->dup_files[i]->id] = i;
+}
+
+static void
+codebase_fingerprints_push (struct codebase_fingerprints *fingerprints,
+                            uint64_t hash, uint32_t file, uint32_t pos)
+{
+    if (fingerprints->count == fingerprints->capacity)
+        {
+            fingerprints->capacity = fingerprints->capacity == 0
+                                         ? 256
+                                         : fingerprints->capacity * 2;
+            fingerprints->items = xrealloc (
+                fingerprints->items,
+                fingerprints->capacity * sizeof (*fingerprints->items));
+        }
+
+    fingerprints->items[fingerprints->count++] = (struct codebase_fingerprint) {
+        .hash = hash,
+        .file = file,
+        .pos = pos,
+    };
+}
+
+/* Fingerprint a file by winnowing: hash every run of K consecutive code
+   lines with a rolling hash, and keep the smallest hash of every W
+   consecutive runs.  Any clone of at least K + W - 1 lines then shares
+   at least one fingerprint with its original, unless it is one of more
+   than DUP_MAX_COPIES copies.  */
+static void
+codebase_dup_worker_fingerprint (struct codebase_dup_worker *dups,
+                                 const uint64_t *hashes, size_t count,
+                                 uint32_t id)
+{
+    const uint64_t base = 0x100000001b3ULL;
+    const size_t k = codebase_dup_kgram_lines ();
+    const size_t grams = count - k + 1;
+    const size_t w = opt_duplicate_lines - k + 1 < grams
+                         ? opt_duplicate_lines - k + 1
+                         : grams;
+    uint64_t *gram_hashes = xrealloc (NULL, grams * sizeof (uint64_t));
+    size_t *window = xrealloc (NULL, grams * sizeof (size_t));
+    size_t window_head = 0, window_tail = 0;
+    size_t selected = SIZE_MAX;
+    uint64_t power = 1;
+    uint64_t gram = 0;
+
+    for (size_t i = 0; i < k; i++)
+        {
+            gram = gram * base + hashes[i];
+
+            if (i > 0)
+                power *= base;
+        }
+
+    for (size_t i = 0; i < grams; i++)
+        {
+            gram_hashes[i] = gram;
+
+            if (i + k < count)
+                gram = (gram - hashes[i] * power) * base + hashes[i + k];
+        }
+
+    /* WINDOW is a deque of positions with increasing hashes, so that its
+       head is always the rightmost minimum of the current window.  */
+    for (size_t i = 0; i < grams; i++)
+        {
+            while (window_tail > window_head
+                   && gram_hashes[window[window_tail - 1]] >= gram_hashes[i])
+                window_tail--;
+
+            window[window_tail++] = i;
+
+            if (window[window_head] + w <= i)
+                window_head++;
+
+            if (i + 1 < w || window[window_head] == selected)
+                continue;
+
+            selected = window[window_head];
+            codebase_fingerprints_push (
+                &dups->shards[gram_hashes[selected] % DUP_SHARDS],
+                gram_hashes[selected], id, selected);
+        }
+
+    free (gram_hashes);
+    free (window);
+}
+
+/* Keep the code lines collected for the file at PATH, and fingerprint
+   them.  Files too short to contain a clone are not kept.  */
+static void
+codebase_dup_worker_add_file (struct codebase_worker *worker,
+                              const char *path,
+                              enum codebase_language language)
+{
+    struct codebase_dup_worker *dups = &worker->dups;
+    struct codebase_code_lines *code = &dups->code;
+    const size_t worker_count = worker->scanner->worker_count;
+    const size_t worker_index = worker - worker->scanner->workers;
+
+    if (code->count < opt_duplicate_lines)
+        return;
+
+    if (dups->file_count >= (UINT32_MAX - worker_index) / worker_count)
+        return;
+
+    if (dups->file_count == dups->file_capacity)
+        {
+            dups->file_capacity
+                = dups->file_capacity == 0 ? 64 : dups->file_capacity * 2;
+            dups->files = xrealloc (dups->files, dups->file_capacity
+                                                     * sizeof (*dups->files));
+        }
+
+    uint32_t id = dups->file_count * worker_count + worker_index;
+    struct codebase_dup_file *file = &dups->files[dups->file_count++];
+
+    *file = (struct codebase_dup_file) {
+        .path = strdup (path),
+        .language = language,
+        .id = id,
+        .hashes = xrealloc (code->hashes, code->count * sizeof (uint64_t)),
+        .numbers = xrealloc (code->numbers, code->count * sizeof (uint32_t)),
+        .count = code->count,
+        .duplicated = NULL,
+    };
+
+    codebase_dup_worker_fingerprint (dups, file->hashes, file->count, id);
+    *code = (struct codebase_code_lines) { 0 };
+}
+
+struct codebase_dup_pair
+{
+    uint32_t file_a;
+    uint32_t pos_a;
+    uint32_t file_b;
+    uint32_t pos_b;
+};
+
+struct codebase_dup_index_task
+{
+    struct codebase_scanner *scanner;
+    size_t index;
+    size_t stride;
+    struct codebase_dup_pair *pairs;
+    size_t pair_count;
+    size_t pair_capacity;
+    pthread_t thread;
+};
+
+static int
+codebase_fingerprint_compare (const void *a, const void *b)
+{
+    const struct codebase_fingerprint *fp_a = a;
+    const struct codebase_fingerprint *fp_b = b;
+
+    if (fp_a->hash != fp_b->hash)
+        return fp_a->hash < fp_b->hash ? -1 : 1;
+
+    if (fp_a->file != fp_b->file)
+        return fp_a->file < fp_b->file ? -1 : 1;
+
+    return fp_a->pos < fp_b->pos ? -1 : fp_a->pos > fp_b->pos;
+}
+
+/* Build one slice of the fingerprint index: gather the fingerprints of
+   every shard owned by the task from all workers, sort them, and pair
+   the first occurrence of each repeated fingerprint with the others.
+   Each pair is extended on its own, so a fingerprint found thousands of
+   times in one file would make this quadratic in the file's length; such
+   fingerprints are not paired at all.  */
+static void *
+codebase_dup_index_main (void *arg)
+{
+    struct codebase_dup_index_task *task = arg;
+    struct codebase_scanner *scanner = task->scanner;
+
+    for (size_t shard = task->index; shard < DUP_SHARDS; shard += task->stride)
+        {
+            struct codebase_fingerprint *items = NULL;
+            size_t count = 0;
+
+            for (size_t i = 0; i < scanner->worker_count; i++)
+                {
+                    struct codebase_fingerprints *fingerprints
+                        = &scanner->workers[i].dups.shards[shard];
+
+                    if (fingerprints->count == 0)
+                        continue;
+
+                    items = xrealloc (items, (count + fingerprints->count)
+                                                 * sizeof (*items));
+                    memcpy (items + count, fingerprints->items,
+                            fingerprints->count * sizeof (*items));
+                    count += fingerprints->count;
+                    free (fingerprints->items);
+                    *fingerprints = (struct codebase_fingerprints) { 0 };
+                }
+
+            if (count == 0)
+                continue;
+
+            for (size_t i = 0; i < count; i++)
+                items[i].file = scanner->dup_ranks[items[i].file];
+
+            qsort (items, count, sizeof (*items),
+                   &codebase_fingerprint_compare);
+
+            for (size_t i = 0, j; i < count; i = j)
+                {
+                    for (j = i + 1; j < count && items[j].hash == items[i].hash;
+                         j++)
+                        ;
+
+                    if (j - i > DUP_MAX_COPIES)
+                        continue;
+
+                    for (size_t k = i + 1; k < j; k++)
+                        {
+                            if (task->pair_count == task->pair_capacity)
+                                {
+                                    task->pair_capacity
+                                        = task->pair_capacity == 0
+                                              ? 256
+                                              : task->pair_capacity * 2;
+                                    task->pairs = xrealloc (
+                                        task->pairs,
+                                        task->pair_capacity
+                                            * sizeof (*task->pairs));
+                                }
+
+                            task->pairs[task->pair_count++]
+                                = (struct codebase_dup_pair) {
+                                      .file_a = items[i].file,
+                                      .pos_a = items[i].pos,
+                                      .file_b = items[k].file,
+                                      .pos_b = items[k].pos,
+                                  };
+                        }
+                }
+
+            free (items);
+        }
+
+    return NULL;
+}
+
+static int
+codebase_dup_pair_compare (const void *a, const void *b)
+{
+    const struct codebase_dup_pair *pair_a = a;
+    const struct codebase_dup_pair *pair_b = b;
+    const int64_t diag_a = (int64_t) pair_a->pos_b - pair_a->pos_a;
+    const int64_t diag_b = (int64_t) pair_b->pos_b - pair_b->pos_a;
+
+    if (pair_a->file_a != pair_b->file_a)
+        return pair_a->file_a < pair_b->file_a ? -1 : 1;
+
+    if (pair_a->file_b != pair_b->file_b)
+        return pair_a->file_b < pair_b->file_b ? -1 : 1;
+
+    if (diag_a != diag_b)
+        return diag_a < diag_b ? -1 : 1;
+
+    return pair_a->pos_a < pair_b->pos_a ? -1 : pair_a->pos_a > pair_b->pos_a;
+}
+
+struct codebase_dup_clone
+{
+    uint32_t file_a;
+    uint32_t start_a;
+    uint32_t file_b;
+    uint32_t start_b;
+    uint32_t lines;
+};
+
+/* Find the clone around a pair of matching fingerprints by extending the
+   match in both directions, and mark its lines as duplicated.  Returns
+   false if the fingerprints only matched by accident, or the clone is
+   too short.  The end of the forward match is stored in COVERED.  */
+static bool
+codebase_dup_pair_extend (struct codebase_scanner *scanner,
+                          const struct codebase_dup_pair *pair,
+                          struct codebase_dup_clone *clone, uint32_t *covered)
+{
+    struct codebase_dup_file *file_a
+        = codebase_dup_file_get (scanner, pair->file_a);
+    struct codebase_dup_file *file_b
+        = codebase_dup_file_get (scanner, pair->file_b);
+    uint32_t start_a = pair->pos_a, start_b = pair->pos_b;
+    uint32_t end_a = start_a, end_b = start_b;
+
+    while (end_a < file_a->count && end_b < file_b->count
+           && file_a->hashes[end_a] == file_b->hashes[end_b])
+        end_a++, end_b++;
+
+    *covered = end_a;
+
+    if (end_a - start_a < codebase_dup_kgram_lines ())
+        return false;
+
+    while (start_a > 0 && start_b > 0
+           && file_a->hashes[start_a - 1] == file_b->hashes[start_b - 1])
+        start_a--, start_b--;
+
+    uint32_t lines = end_a - start_a;
+
+    /* A block repeated back to back within a file matches itself shifted
+       by one copy; only count the copy itself.  */
+    if (file_a == file_b && start_a + lines > start_b)
+        lines = start_b - start_a;
+
+    if (lines < opt_duplicate_lines)
+        return false;
+
+    *clone = (struct codebase_dup_clone) {
+        .file_a = pair->file_a,
+        .start_a = start_a,
+        .file_b = pair->file_b,
+        .start_b = start_b,
+        .lines = lines,
+    };
+
+    if (file_a->duplicated == NULL)
+        file_a->duplicated = xcalloc (file_a->count, 1);
+
+    if (file_b->duplicated == NULL)
+        file_b->duplicated = xcalloc (file_b->count, 1);
+
+    memset (file_a->duplicated + start_a, 1, lines);
+    memset (file_b->duplicated + start_b, 1, lines);
+    return true;
+}
+
+static struct codebase_dup_location
+codebase_dup_location (struct codebase_scanner *scanner, uint32_t id,
+                       uint32_t start, uint32_t lines)
+{
+    const struct codebase_dup_file *file = codebase_dup_file_get (scanner, id);
+
+    return (struct codebase_dup_location) {
+        .path = strdup (file->path),
+        .first_line = file->numbers[start],
+        .last_line = file->numbers[start + lines - 1],
+    };
+}
+
+/* A run of LINES code lines at START in the file with rank FILE.  */
+struct codebase_dup_region
+{
+    uint32_t file;
+    uint32_t start;
+    uint32_t lines;
+};
+
+/* A distinct side of the clones found.  Sides that are copies of each
+   other are joined into sets with union-find; after that, PARENT is the
+   set's root, and the root holds where the set starts in the list of
+   members and its SIZE.  A side within a longer side in the same file is
+   also copied wherever that one is: COVER is the longest such side.  */
+struct codebase_dup_node
+{
+    struct codebase_dup_region region;
+    uint32_t parent;
+    uint32_t cover; /* UINT32_MAX if none.  */
+    uint32_t first;
+    uint32_t size;
+};
+
+/* The copies of the set of clone sides with root ROOT.  FIRST is the
+   copy listed first, at LINE in PATH.  */
+struct codebase_dup_candidate
+{
+    uint32_t root;
+    uint32_t lines;
+    size_t count;
+    struct codebase_dup_region first;
+    const char *path;
+    uint32_t line;
+};
+
+struct codebase_dup_scratch
+{
+    struct codebase_dup_region *regions;
+    size_t region_capacity;
+    struct codebase_dup_region *keys;
+    size_t key_capacity;
+};
+
+/* By file and start, longest first.  */
+static int
+codebase_dup_region_compare (const void *a, const void *b)
+{
+    const struct codebase_dup_region *region_a = a;
+    const struct codebase_dup_region *region_b = b;
+
+    if (region_a->file != region_b->file)
+        return region_a->file < region_b->file ? -1 : 1;
+
+    if (region_a->start != region_b->start)
+        return region_a->start < region_b->start ? -1 : 1;
+
+    return region_a->lines > region_b->lines ? -1
+                                             : region_a->lines
+                                                   < region_b->lines;
+}
+
+static int
+codebase_dup_node_compare (const void *a, const void *b)
+{
+    const struct codebase_dup_node *node_a = a;
+    const struct codebase_dup_node *node_b = b;
+
+    return codebase_dup_region_compare (&node_a->region, &node_b->region);
+}
+
+/* Same groups next to each other, with the most copies first.  */
+static int
+codebase_dup_candidate_compare_group (const void *a, const void *b)
+{
+    const struct codebase_dup_candidate *candidate_a = a;
+    const struct codebase_dup_candidate *candidate_b = b;
+    int ret = codebase_dup_region_compare (&candidate_a->first,
+                                           &candidate_b->first);
+
+    if (ret != 0)
+        return ret;
+
+    return candidate_a->count > candidate_b->count ? -1
+                                                   : candidate_a->count
+                                                         < candidate_b->count;
+}
+
+/* Heaviest groups first.  Ties are broken by path, not by file ID, as
+   IDs depend on which worker analyzed each file.  */
+static int
+codebase_dup_candidate_compare_weight (const void *a, const void *b)
+{
+    const struct codebase_dup_candidate *candidate_a = a;
+    const struct codebase_dup_candidate *candidate_b = b;
+    const uint64_t weight_a
+        = (uint64_t) candidate_a->lines * candidate_a->count;
+    const uint64_t weight_b
+        = (uint64_t) candidate_b->lines * candidate_b->count;
+    int ret;
+
+    if (weight_a != weight_b)
+        return weight_a > weight_b ? -1 : 1;
+
+    if (candidate_a->lines != candidate_b->lines)
+        return candidate_a->lines > candidate_b->lines ? -1 : 1;
+
+    ret = strcmp (candidate_a->path, candidate_b->path);
+
+    if (ret != 0)
+        return ret;
+
+    return candidate_a->line < candidate_b->line ? -1
+                                                 : candidate_a->line
+                                                       > candidate_b->line;
+}
+
+static uint32_t
+codebase_dup_find (struct codebase_dup_node *nodes, uint32_t node)
+{
+    while (nodes[node].parent != node)
+        {
+            nodes[node].parent = nodes[nodes[node].parent].parent;
+            node = nodes[node].parent;
+        }
+
+    return node;
+}
+
+static uint32_t
+codebase_dup_node_of (const struct codebase_dup_node *nodes, size_t count,
+                      uint32_t file, uint32_t start, uint32_t lines)
+{
+    const struct codebase_dup_node key = {
+        .region = { .file = file, .start = start, .lines = lines },
+    };
+    const struct codebase_dup_node *node
+        = bsearch (&key, nodes, count, sizeof (*nodes),
+                   &codebase_dup_node_compare);
+
+    return node - nodes;
+}
+
+static void
+codebase_dup_scratch_push (struct codebase_dup_region **regions,
+                           size_t *capacity, size_t count,
+                           struct codebase_dup_region region)
+{
+    if (count == *capacity)
+        {
+            *capacity = *capacity == 0 ? 64 : *capacity * 2;
+            *regions = xrealloc (*regions, *capacity * sizeof (**regions));
+        }
+
+    (*regions)[count] = region;
+}
+
+/* Store in SCRATCH the copies of the set of clone sides with root ROOT:
+   its sides, and for each side within a longer one, the same part of
+   every copy of the longer side.  Copies that overlap one before them in
+   the same file are left out.  Returns the number of copies, which are
+   sorted by file and line.  */
+static size_t
+codebase_dup_copies (const struct codebase_dup_node *nodes,
+                     const uint32_t *members, uint32_t root,
+                     struct codebase_dup_scratch *scratch)
+{
+    const struct codebase_dup_node *set = &nodes[root];
+    const uint32_t lines = set->region.lines;
+    size_t count = 0, key_count = 0, unique = 0;
+
+    for (uint32_t i = 0; i < set->size; i++)
+        {
+            const struct codebase_dup_node *node
+                = &nodes[members[set->first + i]];
+            const struct codebase_dup_node *cover;
+
+            if (node->cover == UINT32_MAX)
+                {
+                    codebase_dup_scratch_push (&scratch->regions,
+                                               &scratch->region_capacity,
+                                               count++, node->region);
+                    continue;
+                }
+
+            /* Sides within the same place of the copies of one longer
+               side have the same copies; only find them once.  */
+            cover = &nodes[node->cover];
+            codebase_dup_scratch_push (
+                &scratch->keys, &scratch->key_capacity, key_count++,
+                (struct codebase_dup_region) {
+                    .file = cover->parent,
+                    .start = node->region.start - cover->region.start,
+                });
+        }
+
+    if (key_count != 0)
+        qsort (scratch->keys, key_count, sizeof (*scratch->keys),
+               &codebase_dup_region_compare);
+
+    for (size_t i = 0; i < key_count; i++)
+        {
+            const struct codebase_dup_region *key = &scratch->keys[i];
+            const struct codebase_dup_node *outer = &nodes[key->file];
+
+            if (i > 0 && codebase_dup_region_compare (key, key - 1) == 0)
+                continue;
+
+            for (uint32_t j = 0; j < outer->size; j++)
+                {
+                    const struct codebase_dup_region *copy
+                        = &nodes[members[outer->first + j]].region;
+
+                    codebase_dup_scratch_push (
+                        &scratch->regions, &scratch->region_capacity,
+                        count++,
+                        (struct codebase_dup_region) {
+                            .file = copy->file,
+                            .start = copy->start + key->start,
+                            .lines = lines,
+                        });
+                }
+        }
+
+    qsort (scratch->regions, count, sizeof (*scratch->regions),
+           &codebase_dup_region_compare);
+
+    for (size_t i = 0; i < count; i++)
+        {
+            const struct codebase_dup_region *region = &scratch->regions[i];
+
+            if (unique > 0 && region->file == scratch->regions[unique - 1].file
+                && region->start < scratch->regions[unique - 1].start + lines)
+                continue;
+
+            scratch->regions[unique++] = *region;
+        }
+
+    return unique;
+}
+
+/* Group the clones by the region they copy, and keep the largest groups.
+   The sides of the clones are joined into sets of copies of one another,
+   and a side found within a longer side in the same file is also copied
+   wherever the longer side is, as a region copied as part of a longer
+   clone elsewhere is only paired with one of its copies.  This takes a
+   sort of the sides and one sweep over each file.  */
+static void
+codebase_report_group_duplicates (struct codebase_report *report,
+                                  struct codebase_scanner *scanner,
+                                  struct codebase_dup_clone *clones,
+                                  size_t count)
+{
+    struct codebase_duplicates *duplicates = &report->duplicates;
+    const size_t side_count = count * 2;
+    struct codebase_dup_node *nodes
+        = xcalloc (side_count + 1, sizeof (*nodes));
+    uint32_t *members = xcalloc (side_count + 1, sizeof (*members));
+    struct codebase_dup_candidate *candidates
+        = xcalloc (side_count + 1, sizeof (*candidates));
+    struct codebase_dup_scratch scratch = { 0 };
+    size_t node_count = 0, candidate_count = 0, shown = 0;
+
+    for (size_t i = 0; i < count; i++)
+        {
+            nodes[i * 2].region = (struct codebase_dup_region) {
+                .file = clones[i].file_a,
+                .start = clones[i].start_a,
+                .lines = clones[i].lines,
+            };
+            nodes[i * 2 + 1].region = (struct codebase_dup_region) {
+                .file = clones[i].file_b,
+                .start = clones[i].start_b,
+                .lines = clones[i].lines,
+            };
+        }
+
+    if (side_count != 0)
+        qsort (nodes, side_count, sizeof (*nodes), &codebase_dup_node_compare);
+
+    for (size_t i = 0; i < side_count; i++)
+        if (node_count == 0
+            || codebase_dup_node_compare (&nodes[i], &nodes[node_count - 1])
+                   != 0)
+            nodes[node_count++] = nodes[i];
+
+    /* The longest side seen so far in a file ends last, so it covers
+       every side that it does not start after or end before.  */
+    for (uint32_t i = 0, cover = UINT32_MAX; i < node_count; i++)
+        {
+            const struct codebase_dup_region *region = &nodes[i].region;
+
+            nodes[i].parent = i;
+            nodes[i].cover = UINT32_MAX;
+
+            if (cover != UINT32_MAX
+                && nodes[cover].region.file == region->file
+                && nodes[cover].region.start + nodes[cover].region.lines
+                       >= region->start + region->lines)
+                nodes[i].cover = cover;
+            else
+                cover = i;
+        }
+
+    for (size_t i = 0; i < count; i++)
+        {
+            uint32_t a = codebase_dup_find (
+                nodes, codebase_dup_node_of (nodes, node_count,
+                                             clones[i].file_a,
+                                             clones[i].start_a,
+                                             clones[i].lines));
+            uint32_t b = codebase_dup_find (
+                nodes, codebase_dup_node_of (nodes, node_count,
+                                             clones[i].file_b,
+                                             clones[i].start_b,
+                                             clones[i].lines));
+
+            if (a != b)
+                nodes[a > b ? a : b].parent = a < b ? a : b;
+        }
+
+    /* List the members of each set together, in file order.  */
+    for (uint32_t i = 0; i < node_count; i++)
+        {
+            nodes[i].parent = codebase_dup_find (nodes, i);
+            nodes[nodes[i].parent].size++;
+        }
+
+    for (uint32_t i = 0, first = 0; i < node_count; i++)
+        if (nodes[i].parent == i)
+            {
+                nodes[i].first = first;
+                first += nodes[i].size;
+                nodes[i].size = 0;
+            }
+
+    for (uint32_t i = 0; i < node_count; i++)
+        {
+            struct codebase_dup_node *root = &nodes[nodes[i].parent];
+
+            members[root->first + root->size++] = i;
+        }
+
+    for (uint32_t i = 0; i < node_count; i++)
+        {
+            if (nodes[i].parent != i)
+                continue;
+
+            const size_t copies
+                = codebase_dup_copies (nodes, members, i, &scratch);
+            const struct codebase_dup_file *file
+                = codebase_dup_file_get (scanner, scratch.regions[0].file);
+
+            if (copies < 2)
+                continue;
+
+            candidates[candidate_count++] = (struct codebase_dup_candidate) {
+                .root = i,
+                .lines = nodes[i].region.lines,
+                .count = copies,
+                .first = scratch.regions[0],
+                .path = file->path,
+                .line = file->numbers[scratch.regions[0].start],
+            };
+        }
+
+    if (candidate_count != 0)
+        qsort (candidates, candidate_count, sizeof (*candidates),
+               &codebase_dup_candidate_compare_group);
+
+    for (size_t i = 0; i < candidate_count; i++)
+        if (shown == 0
+            || codebase_dup_region_compare (&candidates[i].first,
+                                            &candidates[shown - 1].first)
+                   != 0)
+            candidates[shown++] = candidates[i];
+
+    if (shown != 0)
+        qsort (candidates, shown, sizeof (*candidates),
+               &codebase_dup_candidate_compare_weight);
+
+    if (shown > DUP_GROUPS_SHOWN)
+        shown = DUP_GROUPS_SHOWN;
+
+    for (size_t i = 0; i < shown; i++)
+        {
+            const struct codebase_dup_candidate *candidate = &candidates[i];
+            struct codebase_dup_group *result = &duplicates->groups[i];
+            const size_t copies = codebase_dup_copies (
+                nodes, members, candidate->root, &scratch);
+
+            /* Only the first few copies are listed.  */
+            result->lines = candidate->lines;
+            result->count = copies;
+            result->location_count
+                = copies < DUP_LOCATIONS_SHOWN ? copies : DUP_LOCATIONS_SHOWN;
+            result->locations = xcalloc (result->location_count,
+                                         sizeof (*result->locations));
+
+            for (size_t j = 0; j < result->location_count; j++)
+                result->locations[j] = codebase_dup_location (
+                    scanner, scratch.regions[j].file,
+                    scratch.regions[j].start, candidate->lines);
+        }
+
+    duplicates->group_count = shown;
+    free (nodes);
+    free (members);
+    free (candidates);
+    free (scratch.regions);
+    free (scratch.keys);
+}
+
+/* Find the duplicated code in the files kept by the workers of SCANNER.
+   The fingerprint index is built by all workers in parallel, one set of
+   shards each; the matches are then verified and extended to whole
+   clones.  */
+static void
+codebase_report_find_duplicates (struct codebase_report *report,
+                                 struct codebase_scanner *scanner)
+{
+    const size_t task_count = scanner->worker_count;
+    struct codebase_dup_index_task *tasks
+        = xcalloc (task_count, sizeof (*tasks));
+    struct codebase_dup_pair *pairs = NULL;
+    struct codebase_dup_clone *clones = NULL;
+    size_t pair_count = 0, clone_count = 0;
+
+    codebase_dup_rank_files (scanner);
+
+    for (size_t i = 0; i < task_count; i++)
+        {
+            tasks[i].scanner = scanner;
+            tasks[i].index = i;
+            tasks[i].stride = task_count;
+
+            if (task_count == 1)
+                {
+                    codebase_dup_index_main (&tasks[i]);
+                    continue;
+                }
+
+            int err = pthread_create (&tasks[i].thread, NULL,
+                                      &codebase_dup_index_main, &tasks[i]);
+
+            if (err != 0)
+                {
+                    errno = err;
+                    report_error ("failed to create worker thread");
+                    exit (EXIT_FAILURE);
+                }
+        }
+
+    for (size_t i = 0; i < task_count; i++)
+        {
+            if (task_count > 1)
+                pthread_join (tasks[i].thread, NULL);
+
+            if (tasks[i].pair_count != 0)
+                {
+                    pairs = xrealloc (pairs,
+                                      (pair_count + tasks[i].pair_count)
+                                          * sizeof (*pairs));
+                    memcpy (pairs + pair_count, tasks[i].pairs,
+                            tasks[i].pair_count * sizeof (*pairs));
+                    pair_count += tasks[i].pair_count;
+                }
+
+            free (tasks[i].pairs);
+        }
+
+    free (tasks);
+
+    /* Sorting by diagonal puts the matches of one clone next to each
+       other, so each clone is only extended once.  */
+    if (pair_count != 0)
+        qsort (pairs, pair_count, sizeof (*pairs),
+               &codebase_dup_pair_compare);
+
+    clones = xrealloc (NULL, (pair_count + 1) * sizeof (*clones));
+
+    uint32_t covered = 0;
+
+    for (size_t i = 0, last = 0; i < pair_count; i++)
+        {
+            if (i > 0 && pairs[last].file_a == pairs[i].file_a
+                && pairs[last].file_b == pairs[i].file_b
+                && (int64_t) pairs[last].pos_b - pairs[last].pos_a
+                       == (int64_t) pairs[i].pos_b - pairs[i].pos_a
+                && pairs[i].pos_a < covered)
+                continue;
+
+            last = i;
+
+            if (codebase_dup_pair_extend (scanner, &pairs[i],
+                                          &clones[clone_count], &covered))
+                clone_count++;
+        }
+
+    free (pairs);
+    codebase_report_group_duplicates (report, scanner, clones, clone_count);
+    free (clones);
+
+    for (size_t i = 0; i < scanner->worker_count; i++)
+        {
+            struct codebase_dup_worker *dups = &scanner->workers[i].dups;
+
+            for (size_t j = 0; j < dups->file_count; j++)
+                {
+                    struct codebase_dup_file *file = &dups->files[j];
+
+                    for (size_t line = 0;
+                         file->duplicated != NULL && line < file->count;
+                         line++)
+                        report->duplicates.lines[file->language]
+                            += file->duplicated[line];
+
+                    free (file->path);
+                    free (file->hashes);
+                    free (file->numbers);
+                    free (file->duplicated);
+                }
+
+            free (dups->files);
+            free (dups->code.hashes);
+            free (dups->code.numbers);
+        }
+
+    free (scanner->dup_files);
+    free (scanner->dup_ranks);
+}
+
+/* Binary reports (--emit-report) hold the totals of a scan, so that the
+   results of scans of different parts of a tree can be merged later.
+   A report is the header, followed by the language records, the file
+   records (with --report-files), a bitmap of the shards it covers and a
+   table of NUL-terminated strings, each starting at an offset given in
+   the header.  Every section is 8-byte aligned, so a report can be used
+   straight from mmap().  Integers are in the byte order of the machine
+   that wrote the report, which is checked by BYTE_ORDER.  */
+
+#define REPORT_MAGIC "SRCSTATS"
+#define REPORT_VERSION 2
+#define REPORT_BYTE_ORDER 0x01020304U
+#define REPORT_HAS_FILES 0x1U
+
+struct codebase_report_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t flags;
+    uint32_t shard_count;
+    uint32_t language_count;
+    uint32_t reserved;
+    uint64_t scan;
+    uint64_t file_count;
+    uint64_t files;
+    uint64_t ignored;
+    uint64_t failed;
+    uint64_t directories;
+    uint64_t lines;
+    uint64_t blank_lines;
+    uint64_t comment_lines;
+    uint64_t code_lines;
+    uint64_t languages_offset;
+    uint64_t files_offset;
+    uint64_t shards_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+};
+
+struct codebase_report_language
+{
+    uint64_t name;
+    struct codebase_counts counts;
+};
+
+struct codebase_report_file
+{
+    uint64_t path;
+    uint32_t language;
+    uint32_t reserved;
+    uint64_t lines;
+    uint64_t blank_lines;
+    uint64_t comment_lines;
+    uint64_t code_lines;
+};
+
+/* Whether PATH, relative to the root of the scan, belongs to the shard
+   being scanned.  */
+static bool
+codebase_report_in_shard (const struct codebase_report *report,
+                          const char *path)
+{
+    const size_t root_len = strlen (report->directory);
+    const char *relative = path + root_len;
+
+    if (opt_shard_count <= 1)
+        return true;
+
+    while (*relative == '/')
+        relative++;
+
+    return hash_bytes (relative, strlen (relative)) % opt_shard_count
+           == opt_shard - 1;
+}
+
+static void
+codebase_report_add_record (struct codebase_report *report, char *path,
+                            enum codebase_language language,
+                            const struct codebase_counts *counts)
+{
+    if (report->record_count == report->record_capacity)
+        {
+            report->record_capacity = report->record_capacity == 0
+                                          ? 256
+                                          : report->record_capacity * 2;
+            report->records = xrealloc (report->records,
+                                        report->record_capacity
+                                            * sizeof (*report->records));
+        }
+
+    report->records[report->record_count++] = (struct codebase_file_record) {
+        .path = path,
+        .language = language,
+        .counts = *counts,
+    };
+}
+
+/* Move the per-file records of OTHER to REPORT.  */
+static void
+codebase_report_take_records (struct codebase_report *report,
+                              struct codebase_report *other)
+{
+    for (size_t i = 0; i < other->record_count; i++)
+        codebase_report_add_record (report, other->records[i].path,
+                                    other->records[i].language,
+                                    &other->records[i].counts);
+
+    free (other->records);
+    other->records = NULL;
+    other->record_count = 0;
+    other->record_capacity = 0;
+}
+
+static size_t
+codebase_shard_words (uint32_t count)
+{
+    return ((size_t) count + 63) / 64;
+}
+
+/* Record that REPORT covers the shards in the bitmap SHARDS of the scan
+   SCAN, which was split into COUNT shards.  Fails if the scan was split
+   differently elsewhere, or if one of the shards is already covered, as
+   its files would otherwise be counted twice.  PATH names the report
+   the shards come from, for diagnostics.  */
+static bool
+codebase_report_add_shards (struct codebase_report *report, const char *path,
+                            uint64_t scan, uint32_t count,
+                            const uint64_t *shards)
+{
+    struct codebase_shard_set *set = NULL;
+
+    for (size_t i = 0; i < report->shard_set_count && set == NULL; i++)
+        if (report->shard_sets[i].scan == scan)
+            set = &report->shard_sets[i];
+
+    if (set == NULL)
+        {
+            report->shard_sets = xrealloc (
+                report->shard_sets, (report->shard_set_count + 1)
+                                        * sizeof (*report->shard_sets));
+            set = &report->shard_sets[report->shard_set_count++];
+            set->scan = scan;
+            set->count = count;
+            set->shards
+                = xcalloc (codebase_shard_words (count), sizeof (uint64_t));
+        }
+    else if (set->count != count)
+        {
+            fprintf (stderr,
+                     "%s: `%s' is split into %u shards, but other reports "
+                     "of the same scan into %u\n",
+                     prog_name, path, (unsigned int) count,
+                     (unsigned int) set->count);
+            return false;
+        }
+
+    for (uint32_t i = 0; i < count; i++)
+        if ((set->shards[i / 64] & shards[i / 64] & (1ULL << i % 64)) != 0)
+            {
+                fprintf (stderr, "%s: `%s' covers shard %u/%u again\n",
+                         prog_name, path, (unsigned int) i + 1,
+                         (unsigned int) count);
+                return false;
+            }
+
+    for (size_t i = 0; i < codebase_shard_words (count); i++)
+        set->shards[i] |= shards[i];
+
+    return true;
+}
+
+static bool
+codebase_report_write (FILE *stream, const void *data, size_t size)
+{
+    return size == 0 || fwrite (data, size, 1, stream) == 1;
+}
+
+static bool
+codebase_report_emit (const struct codebase_report *report, const char *path)
+{
+    struct codebase_report_header header = {
+        .version = REPORT_VERSION,
+        .byte_order = REPORT_BYTE_ORDER,
+        .flags = opt_report_files ? REPORT_HAS_FILES : 0,
+        .shard_count = 1,
+        .language_count = LANG_COUNT,
+        .file_count = opt_report_files ? report->record_count : 0,
+        .files = report->files,
+        .ignored = report->ignored,
+        .failed = report->failed,
+        .directories = report->directories,
+        .lines = report->lines,
+        .blank_lines = report->blank_lines,
+        .comment_lines = report->comment_lines,
+        .code_lines = report->code_lines,
+    };
+    struct codebase_report_language languages[LANG_COUNT];
+    struct codebase_report_file *files
+        = xcalloc (header.file_count + 1, sizeof (*files));
+    char *strings = NULL;
+    size_t strings_size = 0;
+    FILE *stream;
+    bool ret;
+
+    const uint64_t whole = 1;
+    const uint64_t *shards = &whole;
+
+    memcpy (header.magic, REPORT_MAGIC, sizeof (header.magic));
+
+    /* Reports of several different scans merged together make a new
+       scan as a whole.  */
+    if (report->shard_set_count == 1)
+        {
+            header.scan = report->shard_sets[0].scan;
+            header.shard_count = report->shard_sets[0].count;
+            shards = report->shard_sets[0].shards;
+        }
+    else
+        for (size_t i = 0; i < report->shard_set_count; i++)
+            header.scan ^= report->shard_sets[i].scan;
+
+    for (size_t i = 0; i < LANG_COUNT + header.file_count; i++)
+        {
+            const char *string
+                = i < LANG_COUNT ? codebase_language_names[i]
+                                 : report->records[i - LANG_COUNT].path;
+            const size_t len = strlen (string) + 1;
+
+            if (i < LANG_COUNT)
+                languages[i] = (struct codebase_report_language) {
+                    .name = strings_size,
+                    .counts = report->languages[i],
+                };
+            else
+                {
+                    const struct codebase_file_record *record
+                        = &report->records[i - LANG_COUNT];
+
+                    files[i - LANG_COUNT] = (struct codebase_report_file) {
+                        .path = strings_size,
+                        .language = record->language,
+                        .lines = record->counts.lines,
+                        .blank_lines = record->counts.blank_lines,
+                        .comment_lines = record->counts.comment_lines,
+                        .code_lines = record->counts.code_lines,
+                    };
+                }
+
+            strings = xrealloc (strings, strings_size + len);
+            memcpy (strings + strings_size, string, len);
+            strings_size += len;
+        }
+
+    header.languages_offset = sizeof (header);
+    header.files_offset = header.languages_offset + sizeof (languages);
+    header.shards_offset
+        = header.files_offset + header.file_count * sizeof (*files);
+    header.strings_offset
+        = header.shards_offset
+          + codebase_shard_words (header.shard_count) * sizeof (*shards);
+    header.strings_size = strings_size;
+
+    stream = fopen (path, "wb");
+
+    if (stream == NULL)
+        {
+            report_error ("failed to open `%s'", path);
+            free (files);
+            free (strings);
+            return false;
+        }
+
+    ret = codebase_report_write (stream, &header, sizeof (header))
+          && codebase_report_write (stream, languages, sizeof (languages))
+          && codebase_report_write (stream, files,
+                                    header.file_count * sizeof (*files))
+          && codebase_report_write (stream, shards,
+                                    codebase_shard_words (header.shard_count)
+                                        * sizeof (*shards))
+          && codebase_report_write (stream, strings, strings_size);
+
+    if (fclose (stream) != 0)
+        ret = false;
+
+    if (!ret)
+        report_error ("failed to write report `%s'", path);
+
+    free (files);
+    free (strings);
+    return ret;
+}
+
+/* Whether the SIZE bytes at OFFSET are within a file of FILE_SIZE bytes,
+   and suitably aligned.  */
+static bool
+codebase_report_section_valid (uint64_t offset, uint64_t count,
+                               uint64_t size, uint64_t file_size)
+{
+    return offset % 8 == 0 && offset <= file_size
+           && (size == 0 || count <= (file_size - offset) / size);
+}
+
+/* Add the report in the file at PATH to REPORT.  The file is mapped, and
+   read in a single pass.  */
+static bool
+codebase_report_load (struct codebase_report *report, const char *path)
+{
+    const struct codebase_report_header *header;
+    const struct codebase_report_language *languages;
+    const struct codebase_report_file *files;
+    const char *strings;
+    size_t *map;
+    struct stat st;
+    void *data;
+    int fd = open (path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+        {
+            report_error ("failed to open `%s'", path);
+            return false;
+        }
+
+    if (fstat (fd, &st) == -1)
+        {
+            report_error ("failed to stat `%s'", path);
+            close (fd);
+            return false;
+        }
+
+    if ((size_t) st.st_size < sizeof (*header))
+        {
+            errno = EINVAL;
+            report_error ("`%s' is not a report", path);
+            close (fd);
+            return false;
+        }
+
+    data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+
+    if (data == MAP_FAILED)
+        {
+            report_error ("failed to map `%s'", path);
+            return false;
+        }
+
+    header = data;
+    errno = EINVAL;
+
+    if (memcmp (header->magic, REPORT_MAGIC, sizeof (header->magic)) != 0
+        || header->byte_order != REPORT_BYTE_ORDER)
+        {
+            report_error ("`%s' is not a report", path);
+            munmap (data, st.st_size);
+            return false;
+        }
+
+    if (header->version != REPORT_VERSION)
+        {
+            report_error ("`%s' has unsupported version %u", path,
+                          (unsigned int) header->version);
+            munmap (data, st.st_size);
+            return false;
+        }
+
+    if (!codebase_report_section_valid (header->languages_offset,
+                                        header->language_count,
+                                        sizeof (*languages), st.st_size)
+        || !codebase_report_section_valid (header->files_offset,
+                                           header->file_count, sizeof (*files),
+                                           st.st_size)
+        || header->shard_count == 0
+        || !codebase_report_section_valid (
+            header->shards_offset, codebase_shard_words (header->shard_count),
+            sizeof (uint64_t), st.st_size)
+        || !codebase_report_section_valid (header->strings_offset,
+                                           header->strings_size, 1,
+                                           st.st_size)
+        || header->strings_size == 0
+        || ((const char *) data)[header->strings_offset + header->strings_size
+                                 - 1]
+               != 0)
+        {
+            report_error ("`%s' is corrupted", path);
+            munmap (data, st.st_size);
+            return false;
+        }
+
+    languages = (const void *) ((const char *) data + header->languages_offset);
+    files = (const void *) ((const char *) data + header->files_offset);
+    strings = (const char *) data + header->strings_offset;
+
+    if (!codebase_report_add_shards (
+            report, path, header->scan, header->shard_count,
+            (const void *) ((const char *) data + header->shards_offset)))
+        {
+            munmap (data, st.st_size);
+            return false;
+        }
+
+    map = xcalloc (header->language_count + 1, sizeof (*map));
+    report->files += header->files;
+    report->ignored += header->ignored;
+    report->failed += header->failed;
+    report->directories += header->directories;
+    report->lines += header->lines;
+    report->blank_lines += header->blank_lines;
+    report->comment_lines += header->comment_lines;
+    report->code_lines += header->code_lines;
+
+    /* Languages are matched by name, so that reports written by other
+       versions can still be merged.  */
+    for (size_t i = 0; i < header->language_count; i++)
+        {
+            const char *name = languages[i].name < header->strings_size
+                                   ? strings + languages[i].name
+                                   : "";
+            size_t lang = 0;
+
+            while (lang < LANG_COUNT
+                   && strcmp (codebase_language_names[lang], name) != 0)
+                lang++;
+
+            map[i] = lang;
+
+            if (lang < LANG_COUNT)
+                codebase_counts_add (&report->languages[lang],
+                                     &languages[i].counts);
+        }
+
+    for (size_t i = 0; i < header->file_count; i++)
+        {
+            const struct codebase_report_file *file = &files[i];
+            const struct codebase_counts counts = {
+                .files = 1,
+                .lines = file->lines,
+                .blank_lines = file->blank_lines,
+                .comment_lines = file->comment_lines,
+                .code_lines = file->code_lines,
+            };
+
+            if (file->path >= header->strings_size
+                || file->language >= header->language_count
+                || map[file->language] >= LANG_COUNT)
+                continue;
+
+            codebase_report_add_record (report, strdup (strings + file->path),
+                                        map[file->language], &counts);
+        }
+
+    free (map);
+    munmap (data, st.st_size);
+    return true;
+}
+
+/* Add the counts of the file ITEM, of type TYPE, to the breakdowns kept
+   by WORKER.  Takes ownership of the path of ITEM with --report-files.  */
+static void
+codebase_worker_account (struct codebase_worker *worker,
+                         struct codebase_scan_item *item,
+                         const struct codebase_file_type *type,
+                         const struct codebase_counts *counts)
+{
+    struct codebase_report *report = &worker->report;
+
+    codebase_counts_add (&report->languages[type->language], counts);
+    codebase_counts_add (&report->types[type->id], counts);
+
+    if (opt_dirs)
+        {
+            struct codebase_dirstats *stats
+                = codebase_dirmap_get (&worker->dirs, item->node);
+
+            stats->files++;
+            stats->lines += counts->lines;
+            stats->blank_lines += counts->blank_lines;
+            stats->comment_lines += counts->comment_lines;
+            stats->code_lines += counts->code_lines;
+        }
+
+    if (opt_report_files)
+        {
+            codebase_report_add_record (report, item->path, type->language,
+                                        counts);
+            item->path = NULL;
+        }
+}
+
+static void
+codebase_worker_analyze (struct codebase_worker *worker,
+                         struct codebase_scan_item *item)
+{
+    struct codebase_report *report = &worker->report;
+    FILE *file = fopen (item->path, "r");
+
+    if (file == NULL)
+        {
+            report_error ("failed to open file `%s'", item->path);
+            free (item->path);
+            return;
+        }
+
+    struct codebase_code_lines *code
+        = opt_duplicates ? &worker->dups.code : NULL;
+    const unsigned long int lines = report->lines;
+    const unsigned long int blank_lines = report->blank_lines;
+    const unsigned long int comment_lines = report->comment_lines;
+    const unsigned long int code_lines = report->code_lines;
+
+    if (code != NULL)
+        {
+            code->count = 0;
+            code->first_line = report->lines;
+        }
+
+    const struct codebase_file_type *type
+        = codebase_report_analyze_file (report, item->path, file, code);
+
+    if (opt_cold_cache)
+        posix_fadvise (fileno (file), 0, 0, POSIX_FADV_DONTNEED);
+
+    fclose (file);
+
+    if (type != NULL)
+        {
+            const struct codebase_counts counts = {
+                .files = 1,
+                .lines = report->lines - lines,
+                .blank_lines = report->blank_lines - blank_lines,
+                .comment_lines = report->comment_lines - comment_lines,
+                .code_lines = report->code_lines - code_lines,
+            };
+
+            if (code != NULL)
+                codebase_dup_worker_add_file (worker, item->path,
+                                              type->language);
+
+            codebase_worker_account (worker, item, type, &counts);
+        }
+
+    free (item->path);
+}
+
+/* Count a file of SIZE bytes as done for --progress.  */
+static void
+codebase_worker_count_done (struct codebase_worker *worker, off_t size)
+{
+    /* Only this worker writes its counters, so no read-modify-write
+       atomics are needed.  */
+    atomic_store_explicit (
+        &worker->done_files,
+        atomic_load_explicit (&worker->done_files, memory_order_relaxed) + 1,
+        memory_order_relaxed);
+    atomic_store_explicit (
+        &worker->done_bytes,
+        atomic_load_explicit (&worker->done_bytes, memory_order_relaxed)
+            + size,
+        memory_order_relaxed);
+}
+
+static void
+codebase_worker_process (struct codebase_worker *worker,
+                         struct codebase_scan_item *item)
+{
+    const off_t size = item->size;
+
+    if (worker->scanner->progress == NULL)
+        {
+            codebase_worker_analyze (worker, item);
+            return;
+        }
+
+    free (atomic_exchange (&worker->current_path, strdup (item->path)));
+    codebase_worker_analyze (worker, item);
+    codebase_worker_count_done (worker, size);
+}
+
+static double
+timespec_seconds (const struct timespec *ts)
+{
+    return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+static void
+codebase_progress_render (struct codebase_progress *progress,
+                          const char *path, double now)
+{
+    struct codebase_scanner *scanner = progress->scanner;
+    const double elapsed = now - progress->start;
+    const bool walked
+        = atomic_load_explicit (&scanner->walk_done, memory_order_relaxed);
+    const uint64_t found_files = atomic_load_explicit (
+        &scanner->found_files, memory_order_relaxed);
+    const uint64_t found_bytes = atomic_load_explicit (
+        &scanner->found_bytes, memory_order_relaxed);
+    uint64_t files = 0, bytes = 0;
+    char eta[32] = "--:--:--";
+
+    for (size_t i = 0; i < scanner->worker_count; i++)
+        {
+            files += atomic_load_explicit (&scanner->workers[i].done_files,
+                                           memory_order_relaxed);
+            bytes += atomic_load_explicit (&scanner->workers[i].done_bytes,
+                                           memory_order_relaxed);
+        }
+
+    if (files != progress->last_files || bytes != progress->last_bytes)
+        {
+            progress->last_files = files;
+            progress->last_bytes = bytes;
+            progress->last_change = now;
+        }
+
+    /* The total size is only known once the walk is over.  It is not
+       counted ahead by a second walk of the tree, as that would cost far
+       more than the progress display may.  */
+    if (walked && bytes > 0 && elapsed > 0)
+        {
+            const uint64_t left
+                = found_bytes > bytes
+                      ? (uint64_t) ((found_bytes - bytes) * elapsed / bytes)
+                      : 0;
+
+            snprintf (eta, sizeof (eta), "%lu:%02lu:%02lu",
+                      (unsigned long int) (left / 3600),
+                      (unsigned long int) (left / 60 % 60),
+                      (unsigned long int) (left % 60));
+        }
+
+    fprintf (stderr,
+             "%s%lu/%lu%s files, %.1f/%.1f%s MB, %.0f files/s, %.1f MB/s, "
+             "ETA %s",
+             progress->tty ? "\r\033[K" : "", (unsigned long int) files,
+             (unsigned long int) found_files, walked ? "" : "+", bytes / 1e6,
+             found_bytes / 1e6, walked ? "" : "+",
+             elapsed > 0 ? files / elapsed : 0.0,
+             elapsed > 0 ? bytes / 1e6 / elapsed : 0.0, eta);
+
+    if (now - progress->last_change >= PROGRESS_STALL_SECONDS)
+        fprintf (stderr, progress->tty ? " \033[1;31m[stalled %.0fs]\033[0m"
+                                       : " [stalled %.0fs]",
+                 now - progress->last_change);
+
+    if (path != NULL)
+        {
+            const size_t len = strlen (path);
+
+            fprintf (stderr, "  %s%s", len > 48 ? "..." : "",
+                     len > 48 ? path + len - 45 : path);
+        }
+
+    if (!progress->tty)
+        fputc ('\n', stderr);
+
+    fflush (stderr);
+}
+
+/* The render thread: every so often, sum up the counters published by
+   the workers and show them on stderr.  Nothing here is on the path of
+   the workers, which never wait for this thread.  */
+static void *
+codebase_progress_main (void *arg)
+{
+    struct codebase_progress *progress = arg;
+    struct codebase_scanner *scanner = progress->scanner;
+    const long interval_ms = progress->tty ? PROGRESS_INTERVAL_MS
+                                           : PROGRESS_INTERVAL_MS * 10;
+    size_t next_worker = 0;
+    char *path = NULL;
+
+    pthread_mutex_lock (&progress->lock);
+
+    while (!progress->stopping)
+        {
+            struct timespec deadline;
+
+            clock_gettime (CLOCK_MONOTONIC, &deadline);
+            deadline.tv_nsec += (interval_ms % 1000) * 1000000L;
+            deadline.tv_sec
+                += interval_ms / 1000 + deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+
+            while (!progress->stopping
+                   && pthread_cond_timedwait (&progress->wakeup,
+                                              &progress->lock, &deadline)
+                          != ETIMEDOUT)
+                ;
+
+            if (progress->stopping)
+                break;
+
+            /* Take the most recent path published by one of the workers;
+               the path then belongs to this thread.  */
+            for (size_t i = 0; i < scanner->worker_count; i++)
+                {
+                    struct codebase_worker *worker
+                        = &scanner->workers[next_worker];
+                    char *current
+                        = atomic_exchange (&worker->current_path, NULL);
+
+                    next_worker = (next_worker + 1) % scanner->worker_count;
+
+                    if (current != NULL)
+                        {
+                            free (path);
+                            path = current;
+                            break;
+                        }
+                }
+
+            struct timespec now;
+
+            clock_gettime (CLOCK_MONOTONIC, &now);
+            codebase_progress_render (progress, path, timespec_seconds (&now));
+        }
+
+    pthread_mutex_unlock (&progress->lock);
+    free (path);
+    return NULL;
+}
+
+static void
+codebase_progress_start (struct codebase_progress *progress,
+                         struct codebase_scanner *scanner)
+{
+    pthread_condattr_t attr;
+    struct timespec now;
+    int err;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    progress->scanner = scanner;
+    progress->tty = isatty (STDERR_FILENO);
+    progress->start = timespec_seconds (&now);
+    progress->last_change = progress->start;
+    pthread_mutex_init (&progress->lock, NULL);
+    pthread_condattr_init (&attr);
+    pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+    pthread_cond_init (&progress->wakeup, &attr);
+    pthread_condattr_destroy (&attr);
+
+    err = pthread_create (&progress->thread, NULL, &codebase_progress_main,
+                          progress);
+
+    if (err != 0)
+        {
+            errno = err;
+            report_error ("failed to create progress thread");
+            exit (EXIT_FAILURE);
+        }
+}
+
+static void
+codebase_progress_stop (struct codebase_progress *progress)
+{
+    pthread_mutex_lock (&progress->lock);
+    progress->stopping = true;
+    pthread_cond_signal (&progress->wakeup);
+    pthread_mutex_unlock (&progress->lock);
+    pthread_join (progress->thread, NULL);
+    pthread_mutex_destroy (&progress->lock);
+    pthread_cond_destroy (&progress->wakeup);
+
+    if (progress->tty)
+        fputs ("\r\033[K", stderr);
+
+    for (size_t i = 0; i < progress->scanner->worker_count; i++)
+        free (atomic_exchange (&progress->scanner->workers[i].current_path,
+                               NULL));
+}
+
+static void *
+codebase_worker_main (void *arg)
+{
+    struct codebase_worker *worker = arg;
+    struct codebase_scan_queue *queue = &worker->scanner->queue;
+
+    for (;;)
+        {
+            struct codebase_scan_item item;
+
+            pthread_mutex_lock (&queue->lock);
+
+            while (queue->count == 0 && !queue->closed)
+                pthread_cond_wait (&queue->not_empty, &queue->lock);
+
+            if (queue->count == 0)
+                {
+                    pthread_mutex_unlock (&queue->lock);
+                    break;
+                }
+
+            item = queue->items[queue->head];
+            queue->head = (queue->head + 1) % queue->capacity;
+            queue->count--;
+            pthread_cond_signal (&queue->not_full);
+            pthread_mutex_unlock (&queue->lock);
+
+            codebase_worker_process (worker, &item);
+        }
+
+    return NULL;
+}
+
+/* With --processes, files are analyzed by child processes, so that a
+   file which makes an analyzer crash or hang only costs that file.  The
+   walk hands files to the children through a ring in shared memory, the
+   same way it hands them to worker threads through the queue; the
+   children write their results back next to the paths, where the parent
+   picks them up and adds them to the shard of the only worker.  */
+
+enum codebase_result_status
+{
+    RESULT_PENDING,
+    RESULT_DONE,
+    RESULT_IGNORED,
+    RESULT_OPEN_FAILED,
+    RESULT_TIMED_OUT,
+    RESULT_CRASHED
+};
+
+/* A file handed to the children, and its results.  */
+struct codebase_shm_entry
+{
+    _Atomic uint32_t status;
+    uint32_t type; /* File type ID.  */
+    int error;
+    int signal;
+    uint64_t lines;
+    uint64_t blank_lines;
+    uint64_t comment_lines;
+    uint64_t code_lines;
+    char path[PATH_MAX];
+};
+
+/* What a child is doing.  CURRENT and ENTRY are set before the child
+   tries to claim a position in the ring, so that the parent can tell
+   which file a dead child was working on; the ring itself may have been
+   reused for a later position by then.  */
+struct codebase_shm_slot
+{
+    alignas (CACHE_LINE_SIZE) _Atomic uint64_t current; /* Position + 1.  */
+    _Atomic uint32_t entry;
+    _Atomic int64_t started; /* In milliseconds.  */
+};
+
+/* Files are queued at increasing positions, and the position of each
+   holds the index of the entry with its path.  Entries are only reused
+   once their results have been collected, so a file that takes long
+   does not hold up the others.  */
+struct codebase_shm
+{
+    sem_t queued;   /* Posted when a file is queued.  */
+    sem_t finished; /* Posted when a file is done with.  */
+    alignas (CACHE_LINE_SIZE) _Atomic uint64_t published;
+    atomic_bool closed;
+    alignas (CACHE_LINE_SIZE) _Atomic uint64_t claimed;
+    uint32_t capacity;
+    uint32_t *ring;
+    struct codebase_shm_slot *slots;
+    struct codebase_shm_entry *entries;
+};
+
+/* A file a dead child may have claimed, though a live child was seen
+   trying to claim it too.  */
+struct codebase_process_suspect
+{
+    uint64_t position;
+    uint32_t entry;
+    uint32_t status;
+    int signal;
+};
+
+/* The parent's side of the processes.  The supervisor thread reaps,
+   replaces and times out the children and collects their results on its
+   own, so that none of it waits for the walk to submit more files; LOCK
+   guards everything below it, and FREED is signalled whenever the
+   supervisor has been through the children.  */
+struct codebase_process_pool
+{
+    struct codebase_shm *shm;
+    size_t size;
+    pid_t parent;
+    pthread_t supervisor;
+    pthread_mutex_t lock;
+    pthread_cond_t freed;
+    bool stopping;
+    pid_t *pids;
+    bool *killed;
+    size_t running;
+    struct codebase_scan_item *items; /* By entry.  */
+    uint64_t *positions;              /* By entry; UINT64_MAX if free.  */
+    uint32_t *free_entries;
+    size_t free_count;
+    struct codebase_process_suspect *suspects;
+    size_t suspect_count;
+    uint64_t shown; /* Position + 1 of the file shown by --progress.  */
+};
+
+static int64_t
+monotonic_ms (void)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* Wait up to 10 milliseconds for SEM to be posted.  */
+static void
+semaphore_wait_briefly (sem_t *sem)
+{
+    struct timespec deadline;
+
+    clock_gettime (CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += 10000000L;
+
+    if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+    while (sem_timedwait (sem, &deadline) == -1 && errno == EINTR)
+        ;
+}
+
+static void
+codebase_process_analyze (struct codebase_scanner *scanner,
+                          struct codebase_shm_entry *entry)
+{
+    struct codebase_report report = {
+        .directory = scanner->workers[0].report.directory,
+    };
+    FILE *file = fopen (entry->path, "r");
+
+    if (file == NULL)
+        {
+            entry->error = errno;
+            atomic_store (&entry->status, RESULT_OPEN_FAILED);
+            return;
+        }
+
+    const struct codebase_file_type *type
+        = codebase_report_analyze_file (&report, entry->path, file, NULL);
+
+    if (opt_cold_cache)
+        posix_fadvise (fileno (file), 0, 0, POSIX_FADV_DONTNEED);
+
+    fclose (file);
+
+    if (type == NULL)
+        {
+            atomic_store (&entry->status, RESULT_IGNORED);
+            return;
+        }
+
+    entry->type = type->id;
+    entry->lines = report.lines;
+    entry->blank_lines = report.blank_lines;
+    entry->comment_lines = report.comment_lines;
+    entry->code_lines = report.code_lines;
+    atomic_store (&entry->status, RESULT_DONE);
+}
+
+/* A child: claim the next queued file, analyze it, and so on until the
+   walk is over and the ring is empty.  Children never print anything;
+   the parent reports on their behalf.  */
+[[noreturn]]
+static void
+codebase_process_main (struct codebase_scanner *scanner, size_t index)
+{
+    struct codebase_shm *shm = scanner->processes->shm;
+    struct codebase_shm_slot *slot = &shm->slots[index];
+
+    for (;;)
+        {
+            uint64_t position = atomic_load (&shm->claimed);
+
+            if (position >= atomic_load (&shm->published))
+                {
+                    if (atomic_load (&shm->closed)
+                        && position >= atomic_load (&shm->published))
+                        break;
+
+                    /* Nobody will close the ring if the parent died.  */
+                    if (getppid () != scanner->processes->parent)
+                        break;
+
+                    semaphore_wait_briefly (&shm->queued);
+                    continue;
+                }
+
+            const uint32_t entry = shm->ring[position % shm->capacity];
+
+            atomic_store (&slot->started, monotonic_ms ());
+            atomic_store (&slot->entry, entry);
+            atomic_store (&slot->current, position + 1);
+
+            if (!atomic_compare_exchange_strong (&shm->claimed, &position,
+                                                 position + 1))
+                continue;
+
+            codebase_process_analyze (scanner, &shm->entries[entry]);
+            atomic_store (&slot->current, 0);
+            sem_post (&shm->finished);
+        }
+
+    atomic_store (&slot->current, 0);
+    _exit (EXIT_SUCCESS);
+}
+
+static void
+codebase_process_spawn (struct codebase_scanner *scanner, size_t index)
+{
+    struct codebase_process_pool *pool = scanner->processes;
+    pid_t pid;
+
+    atomic_store (&pool->shm->slots[index].current, 0);
+    pool->killed[index] = false;
+    fflush (NULL);
+    pid = fork ();
+
+    if (pid == -1)
+        {
+            report_error ("failed to create worker process");
+            exit (EXIT_FAILURE);
+        }
+
+    if (pid == 0)
+        {
+#ifdef __linux__
+            /* Do not outlive the parent even when stuck on a file.  This
+               fires when the thread that forked exits, which the
+               supervisor only does once every child has.  */
+            prctl (PR_SET_PDEATHSIG, SIGKILL);
+#endif
+
+            if (getppid () != pool->parent)
+                _exit (EXIT_FAILURE);
+
+            codebase_process_main (scanner, index);
+        }
+
+    pool->pids[index] = pid;
+    pool->running++;
+}
+
+/* Whether a live child other than the one in slot EXCEPT is at
+   POSITION.  */
+static bool
+codebase_process_pool_busy (const struct codebase_process_pool *pool,
+                            uint64_t position, size_t except)
+{
+    for (size_t i = 0; i < opt_processes; i++)
+        if (i != except && pool->pids[i] != 0
+            && atomic_load (&pool->shm->slots[i].current) == position + 1)
+            return true;
+
+    return false;
+}
+
+/* Give up on the file at POSITION, in entry INDEX, which was claimed by
+   a child that is no longer there to finish it, giving it STATUS.
+   Returns false if it cannot be told yet, as a live child other than the
+   one in slot EXCEPT is at POSITION too.  */
+static bool
+codebase_process_pool_abandon (struct codebase_process_pool *pool,
+                               uint64_t position, uint32_t index,
+                               size_t except, uint32_t status, int signal)
+{
+    struct codebase_shm *shm = pool->shm;
+    struct codebase_shm_entry *entry = &shm->entries[index];
+    uint32_t pending = RESULT_PENDING;
+
+    if (pool->positions[index] != position
+        || position >= atomic_load (&shm->claimed))
+        return true;
+
+    if (codebase_process_pool_busy (pool, position, except))
+        return false;
+
+    entry->signal = signal;
+    atomic_compare_exchange_strong (&entry->status, &pending, status);
+    return true;
+}
+
+/* Add the results of ENTRY, which was queued for ITEM, to the only
+   worker.  */
+static void
+codebase_process_collect (struct codebase_scanner *scanner,
+                          struct codebase_scan_item *item,
+                          const struct codebase_shm_entry *entry)
+{
+    struct codebase_worker *worker = &scanner->workers[0];
+    struct codebase_report *report = &worker->report;
+    const uint32_t status = atomic_load (&entry->status);
+
+    switch (status)
+        {
+        case RESULT_DONE:
+            break;
+        case RESULT_IGNORED:
+            report->ignored++;
+            return;
+        case RESULT_OPEN_FAILED:
+            errno = entry->error;
+            report_error ("failed to open file `%s'", item->path);
+            return;
+        default:
+            fprintf (stderr, "%s: %s: %s\n", prog_name, item->path,
+                     status == RESULT_TIMED_OUT
+                         ? "analysis timed out, skipped"
+                     : entry->signal != 0
+                         ? strsignal (entry->signal)
+                         : "worker process exited unexpectedly");
+            report->failed++;
+            return;
+        }
+
+    const struct codebase_counts counts = {
+        .files = 1,
+        .lines = entry->lines,
+        .blank_lines = entry->blank_lines,
+        .comment_lines = entry->comment_lines,
+        .code_lines = entry->code_lines,
+    };
+
+    report->files++;
+    report->lines += counts.lines;
+    report->blank_lines += counts.blank_lines;
+    report->comment_lines += counts.comment_lines;
+    report->code_lines += counts.code_lines;
+    codebase_worker_account (worker, item, codebase_file_types[entry->type],
+                             &counts);
+}
+
+/* Reap and replace dead children, kill the ones stuck on a file for too
+   long, and collect the results of the files done with.  Called with the
+   pool locked.  */
+static void
+codebase_process_pool_poll (struct codebase_scanner *scanner)
+{
+    struct codebase_process_pool *pool = scanner->processes;
+    struct codebase_shm *shm = pool->shm;
+    struct codebase_worker *worker = &scanner->workers[0];
+    size_t oldest = SIZE_MAX;
+    int64_t now;
+    pid_t pid;
+    int status;
+
+    while ((pid = waitpid (-1, &status, WNOHANG)) > 0)
+        {
+            size_t index = 0;
+
+            while (index < opt_processes && pool->pids[index] != pid)
+                index++;
+
+            if (index == opt_processes)
+                continue;
+
+            const uint64_t current = atomic_load (&shm->slots[index].current);
+            const struct codebase_process_suspect suspect = {
+                .position = current - 1,
+                .entry = atomic_load (&shm->slots[index].entry),
+                .status = pool->killed[index] ? RESULT_TIMED_OUT
+                                              : RESULT_CRASHED,
+                .signal = WIFSIGNALED (status) ? WTERMSIG (status) : 0,
+            };
+
+            if (current != 0
+                && !codebase_process_pool_abandon (
+                    pool, suspect.position, suspect.entry, index,
+                    suspect.status, suspect.signal))
+                {
+                    pool->suspects = xrealloc (
+                        pool->suspects, (pool->suspect_count + 1)
+                                            * sizeof (*pool->suspects));
+                    pool->suspects[pool->suspect_count++] = suspect;
+                }
+
+            pool->pids[index] = 0;
+            pool->running--;
+
+            if (!atomic_load (&shm->closed)
+                || atomic_load (&shm->claimed) < atomic_load (&shm->published))
+                codebase_process_spawn (scanner, index);
+        }
+
+    now = monotonic_ms ();
+
+    for (size_t i = 0; i < opt_processes; i++)
+        {
+            const uint64_t current = atomic_load (&shm->slots[i].current);
+            const int64_t started = atomic_load (&shm->slots[i].started);
+
+            if (pool->pids[i] == 0 || current == 0)
+                continue;
+
+            if (oldest == SIZE_MAX
+                || started < atomic_load (&shm->slots[oldest].started))
+                oldest = i;
+
+            if (opt_file_timeout != 0 && !pool->killed[i]
+                && now - started > (int64_t) opt_file_timeout * 1000)
+                {
+                    kill (pool->pids[i], SIGKILL);
+                    pool->killed[i] = true;
+                }
+        }
+
+    /* By now, the live children seen at the positions of the suspects
+       have either claimed them or moved on.  */
+    for (size_t i = 0; i < pool->suspect_count;)
+        {
+            const struct codebase_process_suspect *suspect
+                = &pool->suspects[i];
+
+            if (codebase_process_pool_abandon (
+                    pool, suspect->position, suspect->entry, SIZE_MAX,
+                    suspect->status, suspect->signal))
+                pool->suspects[i] = pool->suspects[--pool->suspect_count];
+            else
+                i++;
+        }
+
+    /* Show the file that has been worked on the longest, which is the
+       one holding things up if anything is.  */
+    if (scanner->progress != NULL && oldest != SIZE_MAX)
+        {
+            const uint64_t current
+                = atomic_load (&shm->slots[oldest].current);
+            const uint32_t index = atomic_load (&shm->slots[oldest].entry);
+
+            if (current != 0 && current != pool->shown
+                && pool->positions[index] == current - 1)
+                {
+                    pool->shown = current;
+                    free (atomic_exchange (&worker->current_path,
+                                           strdup (pool->items[index].path)));
+                }
+        }
+
+    for (uint32_t i = 0; i < shm->capacity; i++)
+        {
+            struct codebase_shm_entry *entry = &shm->entries[i];
+
+            if (pool->positions[i] == UINT64_MAX
+                || atomic_load (&entry->status) == RESULT_PENDING)
+                continue;
+
+            codebase_process_collect (scanner, &pool->items[i], entry);
+
+            if (scanner->progress != NULL)
+                codebase_worker_count_done (worker, pool->items[i].size);
+
+            free (pool->items[i].path);
+            pool->positions[i] = UINT64_MAX;
+            pool->free_entries[pool->free_count++] = i;
+        }
+
+    pthread_cond_broadcast (&pool->freed);
+}
+
+/* The supervisor thread: poll whenever a file is done with, and at least
+   every 10 milliseconds.  */
+static void *
+codebase_process_supervisor_main (void *arg)
+{
+    struct codebase_scanner *scanner = arg;
+    struct codebase_process_pool *pool = scanner->processes;
+
+    pthread_mutex_lock (&pool->lock);
+
+    while (!pool->stopping)
+        {
+            codebase_process_pool_poll (scanner);
+            pthread_mutex_unlock (&pool->lock);
+            semaphore_wait_briefly (&pool->shm->finished);
+            pthread_mutex_lock (&pool->lock);
+        }
+
+    pthread_mutex_unlock (&pool->lock);
+    return NULL;
+}
+
+static void
+codebase_process_pool_start (struct codebase_scanner *scanner)
+{
+    struct codebase_process_pool *pool = xcalloc (1, sizeof (*pool));
+    const uint32_t capacity = opt_processes * PROCESS_QUEUE_FILES;
+    const size_t ring_size = capacity * sizeof (uint32_t);
+    const size_t slots_size
+        = opt_processes * sizeof (struct codebase_shm_slot);
+    struct codebase_shm *shm;
+    int err;
+
+    /* The sizes of the header and of the ring (of PROCESS_QUEUE_FILES
+       entries per process) are multiples of the cache line size, so the
+       slots that follow are aligned.  */
+    pool->size = sizeof (*shm) + ring_size + slots_size
+                 + capacity * sizeof (struct codebase_shm_entry);
+    shm = mmap (NULL, pool->size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (shm == MAP_FAILED)
+        {
+            report_error ("failed to map shared memory");
+            exit (EXIT_FAILURE);
+        }
+
+    if (sem_init (&shm->queued, 1, 0) == -1
+        || sem_init (&shm->finished, 1, 0) == -1)
+        {
+            report_error ("failed to create semaphores");
+            exit (EXIT_FAILURE);
+        }
+
+    shm->capacity = capacity;
+    shm->ring = (void *) (shm + 1);
+    shm->slots = (void *) ((char *) shm->ring + ring_size);
+    shm->entries = (void *) ((char *) shm->slots + slots_size);
+
+    pool->shm = shm;
+    pool->parent = getpid ();
+    pool->pids = xcalloc (opt_processes, sizeof (pid_t));
+    pool->killed = xcalloc (opt_processes, sizeof (bool));
+    pool->items = xcalloc (capacity, sizeof (*pool->items));
+    pool->positions = xcalloc (capacity, sizeof (*pool->positions));
+    pool->free_entries = xcalloc (capacity, sizeof (*pool->free_entries));
+
+    for (uint32_t i = 0; i < capacity; i++)
+        {
+            pool->positions[i] = UINT64_MAX;
+            pool->free_entries[pool->free_count++] = capacity - 1 - i;
+        }
+
+    pthread_mutex_init (&pool->lock, NULL);
+    pthread_cond_init (&pool->freed, NULL);
+    scanner->processes = pool;
+
+    for (size_t i = 0; i < opt_processes; i++)
+        codebase_process_spawn (scanner, i);
+
+    err = pthread_create (&pool->supervisor, NULL,
+                          &codebase_process_supervisor_main, scanner);
+
+    if (err != 0)
+        {
+            errno = err;
+            report_error ("failed to create supervisor thread");
+            exit (EXIT_FAILURE);
+        }
+}
+
+/* Queue ITEM for the children.  Takes ownership of its path.  */
+static void
+codebase_process_pool_submit (struct codebase_scanner *scanner,
+                              struct codebase_scan_item *item)
+{
+    struct codebase_process_pool *pool = scanner->processes;
+    struct codebase_shm *shm = pool->shm;
+    const size_t len = strlen (item->path);
+
+    if (len >= PATH_MAX)
+        {
+            errno = ENAMETOOLONG;
+            report_error ("failed to open file `%s'", item->path);
+            free (item->path);
+            return;
+        }
+
+    pthread_mutex_lock (&pool->lock);
+
+    while (pool->free_count == 0)
+        pthread_cond_wait (&pool->freed, &pool->lock);
+
+    const uint32_t index = pool->free_entries[--pool->free_count];
+    struct codebase_shm_entry *entry = &shm->entries[index];
+    const uint64_t position = atomic_load (&shm->published);
+
+    memcpy (entry->path, item->path, len + 1);
+    entry->signal = 0;
+    atomic_store (&entry->status, RESULT_PENDING);
+    pool->items[index] = *item;
+    pool->positions[index] = position;
+    shm->ring[position % shm->capacity] = index;
+    atomic_store (&shm->published, position + 1);
+    pthread_mutex_unlock (&pool->lock);
+    sem_post (&shm->queued);
+}
+
+/* Wait for the children to finish the queued files and exit.  */
+static void
+codebase_process_pool_finish (struct codebase_scanner *scanner)
+{
+    struct codebase_process_pool *pool = scanner->processes;
+    struct codebase_shm *shm = pool->shm;
+
+    pthread_mutex_lock (&pool->lock);
+    atomic_store (&shm->closed, true);
+
+    for (size_t i = 0; i < opt_processes; i++)
+        sem_post (&shm->queued);
+
+    while (pool->running > 0 || pool->free_count < shm->capacity)
+        pthread_cond_wait (&pool->freed, &pool->lock);
+
+    pool->stopping = true;
+    pthread_mutex_unlock (&pool->lock);
+    sem_post (&shm->finished);
+    pthread_join (pool->supervisor, NULL);
+    pthread_mutex_destroy (&pool->lock);
+    pthread_cond_destroy (&pool->freed);
+    sem_destroy (&shm->queued);
+    sem_destroy (&shm->finished);
+    munmap (shm, pool->size);
+    free (pool->pids);
+    free (pool->killed);
+    free (pool->items);
+    free (pool->positions);
+    free (pool->free_entries);
+    free (pool->suspects);
+    free (pool);
+    scanner->processes = NULL;
+}
+
+static void
+codebase_scanner_init (struct codebase_scanner *scanner,
+                       struct codebase_report *report)
+{
+    scanner->worker_count = opt_processes > 0 ? 1 : opt_jobs;
+    scanner->threaded = opt_processes == 0 && opt_jobs > 1;
+    scanner->workers
+        = xaligned_alloc (scanner->worker_count * sizeof (*scanner->workers));
+
+    for (size_t i = 0; i < scanner->worker_count; i++)
+        {
+            scanner->workers[i].report.directory = report->directory;
+            scanner->workers[i].report.types = xaligned_alloc (
+                codebase_file_type_count * sizeof (struct codebase_counts));
+            scanner->workers[i].scanner = scanner;
+        }
+
+    if (opt_io_window > 1)
+        scanner->window
+            = xcalloc (opt_io_window, sizeof (*scanner->window));
+
+    if (opt_progress)
+        {
+            scanner->progress = xcalloc (1, sizeof (*scanner->progress));
+            codebase_progress_start (scanner->progress, scanner);
+        }
+
+    if (opt_processes > 0)
+        codebase_process_pool_start (scanner);
+
+    if (!scanner->threaded)
+        return;
+
+    scanner->queue.capacity = scanner->worker_count * 64;
+    scanner->queue.items
+        = xcalloc (scanner->queue.capacity, sizeof (*scanner->queue.items));
+    pthread_mutex_init (&scanner->queue.lock, NULL);
+    pthread_cond_init (&scanner->queue.not_empty, NULL);
+    pthread_cond_init (&scanner->queue.not_full, NULL);
+
+    for (size_t i = 0; i < scanner->worker_count; i++)
+        {
+            int err = pthread_create (&scanner->workers[i].thread, NULL,
+                                      &codebase_worker_main,
+                                      &scanner->workers[i]);
+
+            if (err != 0)
+                {
+                    errno = err;
+                    report_error ("failed to create worker thread");
+                    exit (EXIT_FAILURE);
+                }
+        }
+}
+
+static void
+codebase_scanner_dispatch (struct codebase_scanner *scanner,
+                           struct codebase_scan_item *item)
+{
+    struct codebase_scan_queue *queue = &scanner->queue;
+
+    if (scanner->processes != NULL)
+        {
+            codebase_process_pool_submit (scanner, item);
+            return;
+        }
+
+    if (!scanner->threaded)
+        {
+            codebase_worker_process (&scanner->workers[0], item);
+            return;
+        }
+
+    pthread_mutex_lock (&queue->lock);
+
+    while (queue->count == queue->capacity)
+        pthread_cond_wait (&queue->not_full, &queue->lock);
+
+    queue->items[(queue->head + queue->count) % queue->capacity] = *item;
+    queue->count++;
+    pthread_cond_signal (&queue->not_empty);
+    pthread_mutex_unlock (&queue->lock);
+}
+
+static int
+codebase_scan_item_compare (const void *a, const void *b)
+{
+    const struct codebase_scan_item *item_a = a;
+    const struct codebase_scan_item *item_b = b;
+
+    if (item_a->physical != item_b->physical)
+        return item_a->physical < item_b->physical ? -1 : 1;
+
+    return item_a->ino < item_b->ino ? -1 : item_a->ino > item_b->ino;
+}
+
+/* Physical location of the first block of the file at PATH, or
+   UINT64_MAX if unknown.  */
+static uint64_t
+codebase_file_physical (const char *path)
+{
+#ifdef __linux__
+    const int fd = open (path, O_RDONLY | O_CLOEXEC);
+
+    union
+    {
+        struct fiemap map;
+        char buf[sizeof (struct fiemap) + sizeof (struct fiemap_extent)];
+    } fiemap = { 0 };
+
+    fiemap.map.fm_length = FIEMAP_MAX_OFFSET;
+    fiemap.map.fm_extent_count = 1;
+
+    if (fd == -1)
+        return UINT64_MAX;
+
+    const bool mapped = ioctl (fd, FS_IOC_FIEMAP, &fiemap.map) == 0
+                        && fiemap.map.fm_mapped_extents > 0;
+
+    close (fd);
+
+    if (mapped)
+        return fiemap.map.fm_extents[0].fe_physical;
+#else
+    (void) path;
+#endif
+
+    return UINT64_MAX;
+}
+
+/* Ask the kernel to start reading the file at PATH into the page cache.
+   The file is closed again right away, so that only files being
+   analyzed hold descriptors.  */
+static void
+codebase_file_readahead (const char *path)
+{
+    const int fd = open (path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+        return;
+
+    posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+    close (fd);
+}
+
+/* Hand the files in the window over to the workers, in the order they
+   are laid out on disk.  With --cold-cache, the kernel is asked to read
+   the next few files while the current ones are being analyzed.  */
+static void
+codebase_scanner_flush (struct codebase_scanner *scanner)
+{
+    size_t advised = 0;
+
+    if (scanner->window_count == 0)
+        return;
+
+    qsort (scanner->window, scanner->window_count, sizeof (*scanner->window),
+           &codebase_scan_item_compare);
+
+    for (size_t i = 0; i < scanner->window_count; i++)
+        {
+            for (; opt_cold_cache && advised < scanner->window_count
+                   && advised <= i + IO_READAHEAD_FILES;
+                 advised++)
+                codebase_file_readahead (scanner->window[advised].path);
+
+            codebase_scanner_dispatch (scanner, &scanner->window[i]);
+        }
+
+    scanner->window_count = 0;
+}
+
+/* Hand a file over to the workers.  Takes ownership of PATH.  */
+static void
+codebase_scanner_submit (struct codebase_scanner *scanner, char *path,
+                         uint32_t node, const struct stat *st)
+{
+    struct codebase_scan_item item = {
+        .path = path,
+        .node = node,
+        .size = st->st_size,
+        .ino = st->st_ino,
+        .physical = UINT64_MAX,
+    };
+
+    if (opt_max_file_size != 0 && (uint64_t) st->st_size > opt_max_file_size)
+        {
+            fprintf (stderr, "%s: %s: file too large, skipped\n", prog_name,
+                     path);
+            scanner->skipped++;
+            free (path);
+            return;
+        }
+
+    if (scanner->progress != NULL)
+        {
+            atomic_fetch_add_explicit (&scanner->found_files, 1,
+                                       memory_order_relaxed);
+            atomic_fetch_add_explicit (&scanner->found_bytes, st->st_size,
+                                       memory_order_relaxed);
+        }
+
+    if (opt_io_window <= 1)
+        {
+            codebase_scanner_dispatch (scanner, &item);
+            return;
+        }
+
+    if (opt_cold_cache)
+        item.physical = codebase_file_physical (path);
+
+    scanner->window[scanner->window_count++] = item;
+
+    if (scanner->window_count == opt_io_window)
+        codebase_scanner_flush (scanner);
+}
+
+/* Wait for the workers to drain the queue, then merge their partial
+   results into REPORT.  */
+static void
+codebase_scanner_finish (struct codebase_scanner *scanner,
+                         struct codebase_report *report)
+{
+    codebase_scanner_flush (scanner);
+    free (scanner->window);
+    atomic_store_explicit (&scanner->walk_done, true, memory_order_relaxed);
+
+    if (scanner->threaded)
+        {
+            pthread_mutex_lock (&scanner->queue.lock);
+            scanner->queue.closed = true;
+            pthread_cond_broadcast (&scanner->queue.not_empty);
+            pthread_mutex_unlock (&scanner->queue.lock);
+
+            for (size_t i = 0; i < scanner->worker_count; i++)
+                pthread_join (scanner->workers[i].thread, NULL);
+
+            pthread_mutex_destroy (&scanner->queue.lock);
+            pthread_cond_destroy (&scanner->queue.not_empty);
+            pthread_cond_destroy (&scanner->queue.not_full);
+            free (scanner->queue.items);
+        }
+
+    if (scanner->processes != NULL)
+        codebase_process_pool_finish (scanner);
+
+    if (scanner->progress != NULL)
+        {
+            codebase_progress_stop (scanner->progress);
+            free (scanner->progress);
+        }
+
+    for (size_t i = 0; i < scanner->worker_count; i++)
+        {
+            struct codebase_worker *worker = &scanner->workers[i];
+
+            codebase_report_merge (report, &worker->report);
+            codebase_report_take_records (report, &worker->report);
+            free (worker->report.types);
+
+            for (size_t j = 0; j < worker->dirs.capacity; j++)
+                {
+                    const struct codebase_dirstats *stats
+                        = &worker->dirs.entries[j];
+
+                    if (stats->key == 0)
+                        continue;
+
+                    struct codebase_dirnode *node
+                        = &report->dirtree.nodes[stats->key - 1];
+
+                    node->files += stats->files;
+                    node->lines += stats->lines;
+                    node->blank_lines += stats->blank_lines;
+                    node->comment_lines += stats->comment_lines;
+                    node->code_lines += stats->code_lines;
+                }
+
+            free (worker->dirs.entries);
+        }
+
+    report->failed += scanner->skipped;
+
+    if (opt_duplicates)
+        codebase_report_find_duplicates (report, scanner);
+
+    free (scanner->workers);
+}
+
+static bool
+codebase_report_scan (struct codebase_report *report, const char *directory,
+                      uint32_t node)
+{
+    DIR *dirstream = opendir (directory);
+    struct dirent *entry;
+    char **entries = NULL;
+    size_t entries_size = 0;
+
+    if (dirstream == NULL)
+        {
+            report_error ("failed to open directory `%s'", directory);
+            return false;
+        }
+
+    if (codebase_report_in_shard (report, directory))
+        report->directories++;
+
+    while ((entry = readdir (dirstream)) != NULL)
+        {
+            if (strcmp (entry->d_name, ".") == 0
+                || strcmp (entry->d_name, "..") == 0)
+                continue;
+
+            entries = xrealloc (entries, (++entries_size) * sizeof (char *));
+            entries[entries_size - 1] = strdup (entry->d_name);
+        }
 
     entries = xrealloc (entries, (++entries_size) * sizeof (char *));
     entries[entries_size - 1] = NULL;
@@ -638,25 +4112,26 @@ codebase_report_scan (struct codebase_report *report, const char *directory)
             if (lstat (path, &st) == -1)
                 {
                     report_error ("failed to stat `%s'", path);
+                    free (path);
                     continue;
                 }
 
             if (S_ISDIR (st.st_mode))
                 {
-                    codebase_report_scan (report, path);
-                }
-            else if (S_ISREG (st.st_mode))
-                {
-                    FILE *file = fopen (path, "r");
+                    uint32_t child = node;
 
-                    if (file == NULL)
-                        {
-                            report_error ("failed to open file `%s'", path);
-                            continue;
-                        }
+                    if (opt_dirs)
+                        child = codebase_dirtree_add (&report->dirtree,
+                                                      entries[i], node);
 
-                    codebase_report_analyze_file (report, path, file);
-                    fclose (file);
+                    codebase_report_scan (report, path, child);
+                }
+            else if (S_ISREG (st.st_mode)
+                     && codebase_report_in_shard (report, path))
+                {
+                    codebase_scanner_submit (report->scanner, path, node,
+                                             &st);
+                    continue;
                 }
 
             free (path);
@@ -672,8 +4147,26 @@ codebase_report_scan (struct codebase_report *report, const char *directory)
 static bool
 codebase_report_scan_r (struct codebase_report *report, const char *directory)
 {
+    struct codebase_scanner scanner = { 0 };
+    bool ret;
+
     report->directory = strdup (directory);
-    return codebase_report_scan (report, directory);
+    report->types
+        = xcalloc (codebase_file_type_count, sizeof (struct codebase_counts));
+
+    if (opt_dirs)
+        codebase_dirtree_add (&report->dirtree, directory, 0);
+
+    codebase_scanner_init (&scanner, report);
+    report->scanner = &scanner;
+    ret = codebase_report_scan (report, directory, 0);
+    codebase_scanner_finish (&scanner, report);
+    report->scanner = NULL;
+
+    if (opt_dirs)
+        codebase_dirtree_rollup (&report->dirtree);
+
+    return ret;
 }
 
 static void
@@ -710,6 +4203,312 @@ codebase_report_print (const struct codebase_report *report)
     /* clang-format off */
     printf ("\n+---------------+----------------+-------------+----------------+--------------+---------------+----------------+\n");
     /* clang-format on */
+
+    if (report->failed > 0)
+        printf ("\033[1;31m** %lu files could not be analyzed\033[0m\n",
+                report->failed);
+}
+
+struct codebase_breakdown_row
+{
+    char *name;
+    const struct codebase_counts *counts;
+};
+
+static int
+codebase_breakdown_row_compare (const void *a, const void *b)
+{
+    const struct codebase_breakdown_row *row_a = a;
+    const struct codebase_breakdown_row *row_b = b;
+
+    if (row_a->counts->code_lines != row_b->counts->code_lines)
+        return row_a->counts->code_lines < row_b->counts->code_lines ? 1 : -1;
+
+    return strcmp (row_a->name, row_b->name);
+}
+
+/* Print the non-empty rows sorted by code lines, heaviest first.  */
+static void
+codebase_report_print_breakdown (const struct codebase_report *report,
+                                 const char *title, const char *column,
+                                 struct codebase_breakdown_row *rows,
+                                 size_t count)
+{
+    size_t shown = 0;
+
+    for (size_t i = 0; i < count; i++)
+        {
+            if (rows[i].counts->files != 0)
+                rows[shown++] = rows[i];
+            else
+                free (rows[i].name);
+        }
+
+    qsort (rows, shown, sizeof (*rows), &codebase_breakdown_row_compare);
+
+    printf ("\033[2m** %s in `%s':\033[0m\n", title, report->directory);
+
+    /* clang-format off */
+    printf ("+--------------+---------------+----------------+--------------+---------------+----------------+\n");
+    printf ("| \033[1m%-12s\033[0m | \033[1mFiles\033[0m         | \033[1mLines\033[0m          | \033[1mBlank Lines\033[0m  | \033[1mComment Lines\033[0m | \033[1mCode Lines\033[0m     |\n", column);
+    printf ("+--------------+---------------+----------------+--------------+---------------+----------------+\n");
+    /* clang-format on */
+
+    for (size_t i = 0; i < shown; i++)
+        {
+            const struct codebase_counts *counts = rows[i].counts;
+
+            printf ("| \033[1m%-12s\033[0m | %-13lu | \033[1;34m%-14lu\033[0m "
+                    "| \033[2m%-12lu\033[0m | \033[2m%-13lu\033[0m "
+                    "| \033[1;32m%-14lu\033[0m |\n",
+                    rows[i].name, (unsigned long int) counts->files,
+                    (unsigned long int) counts->lines,
+                    (unsigned long int) counts->blank_lines,
+                    (unsigned long int) counts->comment_lines,
+                    (unsigned long int) counts->code_lines);
+            free (rows[i].name);
+        }
+
+    /* clang-format off */
+    printf ("+--------------+---------------+----------------+--------------+---------------+----------------+\n");
+    /* clang-format on */
+}
+
+static void
+codebase_report_print_languages (const struct codebase_report *report)
+{
+    struct codebase_breakdown_row rows[LANG_COUNT];
+
+    for (size_t i = 0; i < LANG_COUNT; i++)
+        {
+            rows[i].name = strdup (codebase_language_names[i]);
+            rows[i].counts = &report->languages[i];
+        }
+
+    codebase_report_print_breakdown (report, "Languages", "Language", rows,
+                                     LANG_COUNT);
+}
+
+static void
+codebase_report_print_types (const struct codebase_report *report)
+{
+    struct codebase_breakdown_row *rows
+        = xcalloc (codebase_file_type_count, sizeof (*rows));
+
+    for (size_t i = 0; i < codebase_file_type_count; i++)
+        {
+            const struct codebase_file_type *type = codebase_file_types[i];
+            const char *prefix = type->match == MATCH_EXTENSION ? "."
+                                 : type->match == MATCH_SHEBANG ? "#!"
+                                                                : "";
+
+            rows[i].name = xrealloc (NULL, strlen (prefix)
+                                               + strlen (type->name) + 1);
+            strcpy (rows[i].name, prefix);
+            strcat (rows[i].name, type->name);
+            rows[i].counts = &report->types[i];
+        }
+
+    codebase_report_print_breakdown (report, "File types", "Type", rows,
+                                     codebase_file_type_count);
+    free (rows);
+}
+
+static void
+codebase_report_print_duplicates (const struct codebase_report *report)
+{
+    const struct codebase_duplicates *duplicates = &report->duplicates;
+    uint64_t total = 0;
+
+    printf ("\033[2m** Duplicated code in `%s':\033[0m\n",
+            report->directory);
+
+    /* clang-format off */
+    printf ("+--------------+----------------+------------------+--------+\n");
+    printf ("| \033[1mLanguage\033[0m     | \033[1mCode Lines\033[0m     | \033[1mDuplicated Lines\033[0m | \033[1mShare\033[0m  |\n");
+    printf ("+--------------+----------------+------------------+--------+\n");
+    /* clang-format on */
+
+    for (size_t i = 0; i <= LANG_COUNT; i++)
+        {
+            const bool is_total = i == LANG_COUNT;
+            const uint64_t code_lines
+                = is_total ? report->code_lines
+                           : report->languages[i].code_lines;
+            const uint64_t lines
+                = is_total ? total : duplicates->lines[i];
+
+            if (!is_total && lines == 0)
+                continue;
+
+            if (is_total)
+                printf ("+--------------+----------------+------------------+"
+                        "--------+\n");
+
+            total += lines;
+            printf ("| \033[1m%-12s\033[0m | %-14lu | \033[1;33m%-16lu\033[0m "
+                    "| %5.1f%% |\n",
+                    is_total ? "Total" : codebase_language_names[i],
+                    (unsigned long int) code_lines, (unsigned long int) lines,
+                    code_lines == 0 ? 0.0 : 100.0 * lines / code_lines);
+        }
+
+    /* clang-format off */
+    printf ("+--------------+----------------+------------------+--------+\n");
+    /* clang-format on */
+
+    if (duplicates->group_count == 0)
+        return;
+
+    printf ("\033[2m** Largest clone groups in `%s':\033[0m\n",
+            report->directory);
+
+    for (size_t i = 0; i < duplicates->group_count; i++)
+        {
+            const struct codebase_dup_group *group = &duplicates->groups[i];
+
+            printf ("\033[1m%2zu.\033[0m %lu lines, %zu copies\n", i + 1,
+                    (unsigned long int) group->lines, group->count);
+
+            for (size_t j = 0; j < group->location_count; j++)
+                printf ("      %s:%lu-%lu\n", group->locations[j].path,
+                        (unsigned long int) group->locations[j].first_line,
+                        (unsigned long int) group->locations[j].last_line);
+
+            if (group->location_count < group->count)
+                printf ("      \033[2m... and %zu more\033[0m\n",
+                        group->count - group->location_count);
+        }
+}
+
+struct codebase_dirrank
+{
+    uint64_t weight;
+    uint32_t node;
+};
+
+/* Whether A ranks below B: lighter first, later-created nodes first on
+   ties so that the output is stable.  */
+static bool
+codebase_dirrank_below (const struct codebase_dirrank *a,
+                        const struct codebase_dirrank *b)
+{
+    return a->weight < b->weight
+           || (a->weight == b->weight && a->node > b->node);
+}
+
+static void
+codebase_dirrank_sift_down (struct codebase_dirrank *heap, size_t count,
+                            size_t index)
+{
+    for (;;)
+        {
+            size_t smallest = index;
+            size_t left = 2 * index + 1;
+            size_t right = left + 1;
+
+            if (left < count
+                && codebase_dirrank_below (&heap[left], &heap[smallest]))
+                smallest = left;
+
+            if (right < count
+                && codebase_dirrank_below (&heap[right], &heap[smallest]))
+                smallest = right;
+
+            if (smallest == index)
+                break;
+
+            struct codebase_dirrank tmp = heap[index];
+            heap[index] = heap[smallest];
+            heap[smallest] = tmp;
+            index = smallest;
+        }
+}
+
+static void
+codebase_report_print_dirs (const struct codebase_report *report)
+{
+    const struct codebase_dirtree *tree = &report->dirtree;
+    const size_t limit
+        = opt_top == 0 || opt_top > tree->count ? tree->count : opt_top;
+    struct codebase_dirrank *heap = xcalloc (limit + 1, sizeof (*heap));
+    size_t count = 0;
+
+    /* Keep the LIMIT heaviest directories in a min-heap, so that the
+       lightest of them can be replaced in logarithmic time.  The root
+       itself is at depth 0.  */
+    for (size_t i = 0; i < tree->count; i++)
+        {
+            const struct codebase_dirnode *node = &tree->nodes[i];
+            struct codebase_dirrank rank
+                = { .weight = node->code_lines, .node = i };
+
+            if (node->depth > opt_depth)
+                continue;
+
+            if (count < limit)
+                {
+                    size_t index = count++;
+
+                    heap[index] = rank;
+
+                    while (index > 0
+                           && codebase_dirrank_below (&heap[index],
+                                                      &heap[(index - 1) / 2]))
+                        {
+                            struct codebase_dirrank tmp = heap[index];
+                            heap[index] = heap[(index - 1) / 2];
+                            heap[(index - 1) / 2] = tmp;
+                            index = (index - 1) / 2;
+                        }
+                }
+            else if (codebase_dirrank_below (&heap[0], &rank))
+                {
+                    heap[0] = rank;
+                    codebase_dirrank_sift_down (heap, count, 0);
+                }
+        }
+
+    /* Pop the heap from the back to get the heaviest directory first.  */
+    for (size_t n = count; n > 1; n--)
+        {
+            struct codebase_dirrank tmp = heap[0];
+            heap[0] = heap[n - 1];
+            heap[n - 1] = tmp;
+            codebase_dirrank_sift_down (heap, n - 1, 0);
+        }
+
+    printf ("\033[2m** Heaviest directories in `%s':\033[0m\n",
+            report->directory);
+
+    /* clang-format off */
+    printf ("+----------------+--------+----------------+---------------+-------------+\n");
+    printf ("| \033[1mCode Lines\033[0m     | \033[1mShare\033[0m  | \033[1mLines\033[0m          | \033[1mFiles\033[0m         | \033[1mDirectories\033[0m | \033[1mPath\033[0m\n");
+    printf ("+----------------+--------+----------------+---------------+-------------+\n");
+    /* clang-format on */
+
+    for (size_t i = 0; i < count; i++)
+        {
+            const struct codebase_dirnode *node = &tree->nodes[heap[i].node];
+            char *path = codebase_dirtree_path (tree, heap[i].node);
+            double share = report->code_lines == 0
+                               ? 0.0
+                               : 100.0 * node->code_lines / report->code_lines;
+
+            printf ("| \033[1;32m%-14lu\033[0m | %5.1f%% "
+                    "| \033[1;34m%-14lu\033[0m | %-13lu | %-11lu | %s\n",
+                    (unsigned long int) node->code_lines, share,
+                    (unsigned long int) node->lines,
+                    (unsigned long int) node->files,
+                    (unsigned long int) node->directories, path);
+            free (path);
+        }
+
+    /* clang-format off */
+    printf ("+----------------+--------+----------------+---------------+-------------+\n");
+    /* clang-format on */
+
+    free (heap);
 }
 
 [[noreturn]]
@@ -718,10 +4517,55 @@ usage (bool error)
 {
     FILE *stream = error ? stderr : stdout;
     fprintf (stream, "Usage: %s [OPTION]... <DIRECTORY>...\n", prog_name);
+    fprintf (stream, "  or:  %s --merge [OPTION]... <REPORT>...\n",
+             prog_name);
     fputs ("Show statistics for the given codebase.\n", stream);
     fputc ('\n', stream);
-    fputs ("  -h, --help      Display this help and exit\n", stream);
-    fputs ("  -v, --version   Output version information and exit\n", stream);
+    fputs ("  -j, --jobs=N        Analyze files using N threads\n", stream);
+    fputs ("  -l, --languages     Show statistics for each language\n", stream);
+    fputs ("  -e, --extensions    Show statistics for each file type\n",
+           stream);
+    fputs ("  -D, --duplicates[=LINES]\n"
+           "                      Find duplicated blocks of at least LINES\n"
+           "                      code lines (default 8)\n",
+           stream);
+    fputs ("  -t, --top=N         List the N heaviest directories\n", stream);
+    fputs ("  -d, --depth=D       Only list directories at most D levels\n"
+           "                      below each given directory (0 for only\n"
+           "                      the directory itself)\n",
+           stream);
+    fputs ("      --io-window=N   Read files in batches of N, in inode order\n"
+           "                      (default 256, 0 for directory order)\n",
+           stream);
+    fputs ("      --cold-cache    Read files in on-disk order, read ahead,\n"
+           "                      and drop them from the page cache after\n",
+           stream);
+    fputs ("      --progress      Show the progress of scans on stderr\n",
+           stream);
+    fputs ("      --processes=N   Analyze files in N separate processes,\n"
+           "                      giving up on files that crash them\n",
+           stream);
+    fputs ("      --file-timeout=SECONDS\n"
+           "                      With --processes, give up on files taking\n"
+           "                      longer than SECONDS (default 60, 0 for no\n"
+           "                      limit)\n",
+           stream);
+    fputs ("      --max-file-size=BYTES\n"
+           "                      Skip files larger than BYTES\n",
+           stream);
+    fputs ("      --shard=K/N     Only scan the K-th of N parts of the tree\n",
+           stream);
+    fputs ("      --emit-report=FILE\n"
+           "                      Write the results to a binary report\n",
+           stream);
+    fputs ("      --report-files  Include every file in the binary report\n",
+           stream);
+    fputs ("      --merge         Merge and show binary reports instead of\n"
+           "                      scanning directories\n",
+           stream);
+    fputs ("  -h, --help          Display this help and exit\n", stream);
+    fputs ("  -v, --version       Output version information and exit\n",
+           stream);
     fputc ('\n', stream);
     fputs ("Bug reports and feedback should be sent to \n<" PACKAGE_BUGREPORT
            ">.\n",
@@ -753,6 +4597,109 @@ invalid_usage (const char *msg)
     exit (EXIT_FAILURE);
 }
 
+static size_t
+parse_count (const char *arg, const char *msg)
+{
+    char *end = NULL;
+    unsigned long int value;
+
+    errno = 0;
+    value = strtoul (arg, &end, 10);
+
+    if (errno != 0 || end == arg || *end != 0 || *arg == '-')
+        invalid_usage (msg);
+
+    return value;
+}
+
+static void
+parse_shard (const char *arg)
+{
+    char *end = NULL;
+
+    errno = 0;
+    opt_shard = strtoul (arg, &end, 10);
+
+    if (errno != 0 || end == arg || *end != '/' || *arg == '-')
+        invalid_usage ("invalid shard, expected K/N");
+
+    opt_shard_count = parse_count (end + 1, "invalid shard, expected K/N");
+
+    if (opt_shard == 0 || opt_shard > opt_shard_count
+        || opt_shard_count > UINT32_MAX)
+        invalid_usage ("invalid shard, expected K/N");
+}
+
+/* Merge the binary reports at PATHS and print the result, without
+   scanning anything.  */
+static bool
+merge_reports (int count, char **paths)
+{
+    struct codebase_report report = { 0 };
+    size_t directory_len = 0;
+    bool success = true;
+
+    report.types
+        = xcalloc (codebase_file_type_count, sizeof (struct codebase_counts));
+
+    for (int i = 0; i < count; i++)
+        {
+            const size_t len = strlen (paths[i]);
+
+            if (!codebase_report_load (&report, paths[i]))
+                {
+                    success = false;
+                    continue;
+                }
+
+            report.directory = xrealloc (report.directory,
+                                         directory_len + len + 3);
+
+            if (directory_len != 0)
+                {
+                    memcpy (report.directory + directory_len, ", ", 2);
+                    directory_len += 2;
+                }
+
+            memcpy (report.directory + directory_len, paths[i], len + 1);
+            directory_len += len;
+        }
+
+    if (report.directory == NULL)
+        {
+            codebase_report_free (&report);
+            return false;
+        }
+
+    for (size_t i = 0; i < report.shard_set_count; i++)
+        {
+            const struct codebase_shard_set *set = &report.shard_sets[i];
+            uint32_t covered = 0;
+
+            for (uint32_t j = 0; j < set->count; j++)
+                covered += (set->shards[j / 64] >> j % 64) & 1;
+
+            if (covered < set->count)
+                fprintf (stderr,
+                         "%s: warning: only %u of %u shards of a scan were "
+                         "merged\n",
+                         prog_name, (unsigned int) covered,
+                         (unsigned int) set->count);
+        }
+
+    codebase_report_print (&report);
+
+    if (opt_languages)
+        codebase_report_print_languages (&report);
+
+    if (opt_emit_report != NULL
+        && !codebase_report_emit (&report, opt_emit_report))
+        success = false;
+
+    codebase_report_free (&report);
+    return success;
+}
+
 int
 main (int argc, char **argv)
 {
@@ -769,6 +4716,80 @@ main (int argc, char **argv)
                 case 'v':
                     show_version ();
                     exit (EXIT_SUCCESS);
+                case 'j':
+                    opt_jobs = parse_count (optarg, "invalid number of jobs");
+
+                    if (opt_jobs == 0)
+                        invalid_usage ("invalid number of jobs");
+
+                    break;
+                case 't':
+                    opt_top = parse_count (optarg, "invalid directory count");
+                    opt_dirs = true;
+                    break;
+                case 'd':
+                    opt_depth = parse_count (optarg, "invalid directory depth");
+                    opt_dirs = true;
+                    break;
+                case 'l':
+                    opt_languages = true;
+                    break;
+                case 'e':
+                    opt_extensions = true;
+                    break;
+                case OPT_IO_WINDOW:
+                    opt_io_window
+                        = parse_count (optarg, "invalid I/O window size");
+                    break;
+                case OPT_COLD_CACHE:
+                    opt_cold_cache = true;
+                    break;
+                case OPT_SHARD:
+                    parse_shard (optarg);
+                    break;
+                case OPT_EMIT_REPORT:
+                    opt_emit_report = optarg;
+                    break;
+                case OPT_REPORT_FILES:
+                    opt_report_files = true;
+                    break;
+                case OPT_MERGE:
+                    opt_merge = true;
+                    break;
+                case OPT_PROGRESS:
+                    opt_progress = true;
+                    break;
+                case OPT_PROCESSES:
+                    opt_processes
+                        = parse_count (optarg, "invalid number of processes");
+
+                    if (opt_processes == 0)
+                        invalid_usage ("invalid number of processes");
+
+                    break;
+                case OPT_FILE_TIMEOUT:
+                    opt_file_timeout = parse_count (optarg, "invalid timeout");
+
+                    if (opt_file_timeout > INT32_MAX)
+                        invalid_usage ("invalid timeout");
+
+                    opt_file_timeout_set = true;
+                    break;
+                case OPT_MAX_FILE_SIZE:
+                    opt_max_file_size
+                        = parse_count (optarg, "invalid file size");
+                    break;
+                case 'D':
+                    opt_duplicates = true;
+
+                    if (optarg != NULL)
+                        opt_duplicate_lines = parse_count (
+                            optarg, "invalid duplicate block length");
+
+                    if (opt_duplicate_lines == 0)
+                        invalid_usage ("invalid duplicate block length");
+
+                    break;
                 case '?':
                     fprintf (stderr, "Try `%s --help' for more information.\n",
                              prog_name);
@@ -779,9 +4800,56 @@ main (int argc, char **argv)
         }
 
     if (optind == argc)
-        invalid_usage ("missing directory operand");
+        invalid_usage (opt_merge ? "missing report operand"
+                                 : "missing directory operand");
+
+    if (opt_report_files && opt_emit_report == NULL)
+        invalid_usage ("--report-files requires --emit-report");
+
+    if (opt_processes > 0 && (opt_jobs > 1 || opt_duplicates))
+        invalid_usage ("--processes cannot be combined with --jobs or "
+                       "--duplicates");
+
+    if (opt_file_timeout_set && opt_processes == 0)
+        invalid_usage ("--file-timeout requires --processes");
+
+    codebase_file_types_init ();
+
+    if (opt_merge)
+        {
+            if (opt_dirs || opt_duplicates || opt_extensions
+                || opt_shard_count > 1)
+                invalid_usage ("--merge can only be combined with "
+                               "--languages and --emit-report");
+
+            return merge_reports (argc - optind, argv + optind)
+                       ? EXIT_SUCCESS
+                       : EXIT_FAILURE;
+        }
 
     bool success = false;
+    struct codebase_report emitted = { 0 };
+
+    emitted.types
+        = xcalloc (codebase_file_type_count, sizeof (struct codebase_counts));
+
+    /* The shards of a scan are told apart from those of other scans by
+       the directories they were given.  */
+    if (opt_emit_report != NULL)
+        {
+            uint64_t *shards = xcalloc (codebase_shard_words (opt_shard_count),
+                                        sizeof (uint64_t));
+            uint64_t scan = 0;
+
+            for (int i = optind; i < argc; i++)
+                scan = scan * 0x100000001b3ULL
+                       ^ hash_bytes (argv[i], strlen (argv[i]) + 1);
+
+            shards[(opt_shard - 1) / 64] |= 1ULL << (opt_shard - 1) % 64;
+            codebase_report_add_shards (&emitted, opt_emit_report, scan,
+                                        opt_shard_count, shards);
+            free (shards);
+        }
 
     for (int i = optind; i < argc; i++)
         {
@@ -793,9 +4861,33 @@ main (int argc, char **argv)
                 }
 
             codebase_report_print (&report);
+
+            if (opt_languages)
+                codebase_report_print_languages (&report);
+
+            if (opt_extensions)
+                codebase_report_print_types (&report);
+
+            if (opt_duplicates)
+                codebase_report_print_duplicates (&report);
+
+            if (opt_dirs)
+                codebase_report_print_dirs (&report);
+
+            if (opt_emit_report != NULL)
+                {
+                    codebase_report_merge (&emitted, &report);
+                    codebase_report_take_records (&emitted, &report);
+                }
+
             codebase_report_free (&report);
             success = true;
         }
 
+    if (success && opt_emit_report != NULL
+        && !codebase_report_emit (&emitted, opt_emit_report))
+        success = false;
+
+    codebase_report_free (&emitted);
     return success ? EXIT_SUCCESS : EXIT_FAILURE;
 }
\ No newline at end of file